@@ -10,6 +10,16 @@ neutrons_registerRecordDeviceDriver(pdbbase)
 
 ## Load record instances
 dbLoadRecords("db/neutrons.db","P=demo")
+# Generator statistics, updated every neutronsStatsPeriod seconds
+var neutronsStatsPeriod 1.0
+dbLoadRecords("db/neutronsStats.db","P=demo")
+# TOF histogram and bank counts for Channel Access clients
+var neutronsSummaryPeriod 1.0
+var neutronsTOFBins 1000
+dbLoadRecords("db/neutronsSummary.db","P=demo,TOF_BINS=1000")
+# Each additional bank creates its own V4 record and generator thread
+#dbLoadRecords("db/neutrons.db","P=demo:bank1,NAME=neutrons:bank1")
+#dbLoadRecords("db/neutrons.db","P=demo:bank2,NAME=neutrons:bank2")
 
 cd ${TOP}/iocBoot/${IOC}
 iocInit()
@@ -24,10 +34,17 @@ epicsThreadSleep(1.0)
 # via V3 records!
 # neutronServerCreateRecord("neutrons", 0.01, 200000)
 
+# Serve pvDatabase records.
+# REQUIRED EDIT when built with USE_PVXS, see src/Makefile:
+# The records are then served by the PVXS server, which starts
+# with iocInit and stops on exit.
+# Comment startPVAServer and pvdbl, which would otherwise start
+# a second PVA server, and use 'pvxsr' to list the PVXS channels.
 startPVAServer
 
 # List V4 channels
 pvdbl
+#pvxsr
 
 #
 # If IOC includes qsrv
@@ -0,0 +1,167 @@
+/* bulkFill.cpp
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+#include "bulkFill.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#    include <immintrin.h>
+#    define NS_HAVE_STREAM_KERNEL
+#endif
+
+namespace epics { namespace neutronServer {
+
+/** Streaming threshold in bytes, 0 until determined */
+static size_t streaming_threshold = 0;
+
+size_t getStreamingThreshold()
+{
+    if (streaming_threshold == 0)
+    {
+        long size = -1;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+        size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+        if (size <= 0)
+            size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+        streaming_threshold = size > 0 ? static_cast<size_t>(size) : NS_STREAM_DEFAULT_THRESHOLD;
+    }
+    return streaming_threshold;
+}
+
+void setStreamingThreshold(size_t bytes)
+{   // No locking..
+    streaming_threshold = bytes;
+}
+
+#ifdef NS_HAVE_STREAM_KERNEL
+
+// The kernels write single elements until 'dst' is aligned for the
+// vector stores, then stream full vectors, then the remaining elements.
+// 'src' may have any alignment.
+// Final 'sfence' orders the streaming stores before those of the caller,
+// for example before the frozen array is handed to another thread.
+
+__attribute__((target("avx2")))
+static void fillAVX2(uint32_t *dst, uint32_t value, size_t count)
+{
+    while (count > 0  &&  (reinterpret_cast<uintptr_t>(dst) & 31))
+    {
+        *(dst++) = value;
+        --count;
+    }
+    const __m256i v = _mm256_set1_epi32(static_cast<int>(value));
+    for (; count >= 8; count -= 8, dst += 8)
+        _mm256_stream_si256(reinterpret_cast<__m256i *>(dst), v);
+    while (count-- > 0)
+        *(dst++) = value;
+    _mm_sfence();
+}
+
+__attribute__((target("avx2")))
+static void streamAVX2(uint32_t *dst, const uint32_t *src, size_t count)
+{
+    while (count > 0  &&  (reinterpret_cast<uintptr_t>(dst) & 31))
+    {
+        *(dst++) = *(src++);
+        --count;
+    }
+    for (; count >= 8; count -= 8, dst += 8, src += 8)
+        _mm256_stream_si256(reinterpret_cast<__m256i *>(dst),
+                            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src)));
+    while (count-- > 0)
+        *(dst++) = *(src++);
+    _mm_sfence();
+}
+
+__attribute__((target("sse2")))
+static void fillSSE2(uint32_t *dst, uint32_t value, size_t count)
+{
+    while (count > 0  &&  (reinterpret_cast<uintptr_t>(dst) & 15))
+    {
+        *(dst++) = value;
+        --count;
+    }
+    const __m128i v = _mm_set1_epi32(static_cast<int>(value));
+    for (; count >= 4; count -= 4, dst += 4)
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst), v);
+    while (count-- > 0)
+        *(dst++) = value;
+    _mm_sfence();
+}
+
+__attribute__((target("sse2")))
+static void streamSSE2(uint32_t *dst, const uint32_t *src, size_t count)
+{
+    while (count > 0  &&  (reinterpret_cast<uintptr_t>(dst) & 15))
+    {
+        *(dst++) = *(src++);
+        --count;
+    }
+    for (; count >= 4; count -= 4, dst += 4, src += 4)
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst),
+                         _mm_loadu_si128(reinterpret_cast<const __m128i *>(src)));
+    while (count-- > 0)
+        *(dst++) = *(src++);
+    _mm_sfence();
+}
+
+#endif // NS_HAVE_STREAM_KERNEL
+
+void fillEvents(uint32_t *dst, uint32_t value, size_t count)
+{
+#ifdef NS_HAVE_STREAM_KERNEL
+    if (count * sizeof(uint32_t) > getStreamingThreshold())
+    {
+        static const bool have_avx2 = __builtin_cpu_supports("avx2");
+        static const bool have_sse2 = __builtin_cpu_supports("sse2");
+        if (have_avx2)
+        {
+            fillAVX2(dst, value, count);
+            return;
+        }
+        if (have_sse2)
+        {
+            fillSSE2(dst, value, count);
+            return;
+        }
+    }
+#endif
+    std::fill(dst, dst + count, value);
+}
+
+void streamEvents(uint32_t *dst, const uint32_t *src, size_t count)
+{
+#ifdef NS_HAVE_STREAM_KERNEL
+    static const bool have_avx2 = __builtin_cpu_supports("avx2");
+    static const bool have_sse2 = __builtin_cpu_supports("sse2");
+    if (have_avx2)
+    {
+        streamAVX2(dst, src, count);
+        return;
+    }
+    if (have_sse2)
+    {
+        streamSSE2(dst, src, count);
+        return;
+    }
+#endif
+    memcpy(dst, src, count * sizeof(uint32_t));
+}
+
+void copyEvents(uint32_t *dst, const uint32_t *src, size_t count)
+{
+    if (count * sizeof(uint32_t) > getStreamingThreshold())
+        streamEvents(dst, src, count);
+    else
+        memcpy(dst, src, count * sizeof(uint32_t));
+}
+
+}} // namespace neutronServer, epics
@@ -0,0 +1,69 @@
+/* bulkFill.h
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#ifndef BULKFILL_H
+#define BULKFILL_H
+
+#include <stdint.h>
+#include <cstddef>
+
+namespace epics { namespace neutronServer {
+
+#define NS_STREAM_BLOCK 4096 /** Elements generated per block before they are streamed to memory */
+#define NS_STREAM_DEFAULT_THRESHOLD (8*1024*1024) /** Streaming threshold in bytes when cache size is unknown */
+
+/** @return Size of last level cache in bytes.
+ *  Arrays larger than this are written with streaming stores.
+ */
+size_t getStreamingThreshold();
+
+/** Override the streaming threshold, 0 to use the last level cache size */
+void setStreamingThreshold(size_t bytes);
+
+/** Fill array with value
+ *
+ *  Large arrays are written with non-temporal (streaming) stores
+ *  that bypass the cache, so data of the record update
+ *  and network serialization that follows remains cached.
+ */
+void fillEvents(uint32_t *dst, uint32_t value, size_t count);
+
+/** Copy array, streaming for large arrays like fillEvents() */
+void copyEvents(uint32_t *dst, const uint32_t *src, size_t count);
+
+/** Copy array, always using streaming stores when supported by the CPU */
+void streamEvents(uint32_t *dst, const uint32_t *src, size_t count);
+
+/** Generate array elements
+ *
+ *  For large arrays, the generator fills a small block in the cache,
+ *  which is then streamed to memory.
+ *
+ *  @param generator Called as generator(uint32_t *block, size_t offset, size_t n)
+ *                   to set elements offset .. offset+n-1 of the array
+ */
+template <class Generator>
+void generateEvents(uint32_t *dst, size_t count, Generator generator)
+{
+    if (count * sizeof(uint32_t) <= getStreamingThreshold())
+    {
+        generator(dst, 0, count);
+        return;
+    }
+    uint32_t block[NS_STREAM_BLOCK];
+    for (size_t offset = 0; offset < count; offset += NS_STREAM_BLOCK)
+    {
+        size_t n = count - offset < NS_STREAM_BLOCK ? count - offset : NS_STREAM_BLOCK;
+        generator(block, offset, n);
+        streamEvents(dst + offset, block, n);
+    }
+}
+
+}}
+
+#endif  /* BULKFILL_H */
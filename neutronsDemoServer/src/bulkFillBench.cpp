@@ -0,0 +1,145 @@
+/* bulkFillBench.cpp
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include <unistd.h>
+#include "bulkFill.h"
+#include "nanoTimer.h"
+
+using namespace epics::neutronServer;
+using namespace std;
+
+/** Compare the array fill loops of the demo server with bulkFill kernels
+ *
+ *  After each fill, a 'hot' buffer is read, similar to the record
+ *  update and serialization that follow the fill in the server.
+ *  Streaming stores should leave that buffer in the cache.
+ */
+
+static void help(const char *name)
+{
+    cout << "USAGE: " << name << " [options]" << endl;
+    cout << "  -h        : Help" << endl;
+    cout << "  -e count  : Events per array (default: 200000, 1M, 4M, 16M)" << endl;
+    cout << "  -n runs   : Runs per test (default 20)" << endl;
+    cout << "  -t bytes  : Streaming threshold (default: last level cache size)" << endl;
+}
+
+/** Read buffer, return sum so it's not optimized away */
+static uint32_t readHot(const vector<uint32_t> &hot)
+{
+    uint32_t sum = 0;
+    for (size_t i=0; i<hot.size(); ++i)
+        sum += hot[i];
+    return sum;
+}
+
+static uint32_t benchmark(const char *name, vector<uint32_t> &array, const vector<uint32_t> &hot, size_t runs, int method)
+{
+    NanoTimer fill_timer, hot_timer;
+    uint32_t sum = 0;
+    size_t count = array.size();
+    uint32_t *dst = &array[0];
+    for (size_t run=0; run<runs; ++run)
+    {
+        uint32_t value = static_cast<uint32_t>(run * 10);
+        readHot(hot);
+        fill_timer.start();
+        switch (method)
+        {
+        case 0: // Loop in PixelRunnable
+        {
+            uint32_t *p = dst;
+            for (size_t i=0; i<count; ++i)
+                *(p++) = value;
+            break;
+        }
+        case 1:
+            std::fill(array.begin(), array.end(), value);
+            break;
+        case 2:
+            fillEvents(dst, value, count);
+            break;
+        case 3: // Realistic pixel IDs, generated in place
+            for (size_t i=0; i<count; ++i)
+                dst[i] = (i%2 == 0) ? (rand() % 1023) : (2048 + rand() % 1024);
+            break;
+        default: // Same, generated in blocks
+            generateEvents(dst, count, [](uint32_t *block, size_t offset, size_t n)
+            {
+                for (size_t i=0; i<n; ++i)
+                    block[i] = ((offset+i)%2 == 0) ? (rand() % 1023) : (2048 + rand() % 1024);
+            });
+        }
+        fill_timer.stop();
+        hot_timer.start();
+        sum += readHot(hot);
+        hot_timer.stop();
+        sum += array[run % count];
+    }
+    cout << "  " << name << ": fill " << fill_timer << ", read hot buffer " << hot_timer << endl;
+    return sum;
+}
+
+int main(int argc,char *argv[])
+{
+    vector<size_t> counts;
+    size_t runs = 20;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "e:n:t:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'e':
+            counts.push_back((size_t)atol(optarg));
+            break;
+        case 'n':
+            runs = (size_t)atol(optarg);
+            break;
+        case 't':
+            setStreamingThreshold((size_t)atol(optarg));
+            break;
+        case 'h':
+            help(argv[0]);
+            return 0;
+        default:
+            help(argv[0]);
+            return -1;
+        }
+    }
+    if (counts.empty())
+    {
+        counts.push_back(200000);
+        counts.push_back(1000000);
+        counts.push_back(4000000);
+        counts.push_back(16000000);
+    }
+
+    cout << "Streaming threshold: " << getStreamingThreshold() << " bytes" << endl;
+    // Hot data of about 1/4 of the cache
+    vector<uint32_t> hot(getStreamingThreshold() / 4 / sizeof(uint32_t), 1);
+    uint32_t sum = 0;
+    for (size_t c=0; c<counts.size(); ++c)
+    {
+        vector<uint32_t> array(counts[c] > 0 ? counts[c] : 1);
+        cout << array.size() << " events (" << array.size() * sizeof(uint32_t) << " bytes):" << endl;
+        sum += benchmark("pointer loop ", array, hot, runs, 0);
+        sum += benchmark("std::fill    ", array, hot, runs, 1);
+        sum += benchmark("fillEvents   ", array, hot, runs, 2);
+        sum += benchmark("random loop  ", array, hot, runs, 3);
+        sum += benchmark("random blocks", array, hot, runs, 4);
+    }
+    // Print to keep sum, hence all the work
+    cout << "(Checksum " << sum << ")" << endl;
+
+    return 0;
+}
@@ -0,0 +1,264 @@
+/* detectorImage.cpp
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#include <algorithm>
+#include <iostream>
+#include "detectorImage.h"
+
+#ifdef USE_PVXS
+#    include <pvxs/nt.h>
+     using namespace pvxs;
+#else
+#   include <pv/standardPVField.h>
+     using namespace epics::pvData;
+     using namespace epics::pvDatabase;
+     using namespace epics::nt;
+     using namespace std;
+#endif
+
+namespace epics { namespace neutronServer {
+
+#ifndef USE_PVXS
+DetectorImageRecord::shared_pointer DetectorImageRecord::create(string const & recordName,
+                                                                size_t width, size_t height)
+{
+    PVStructurePtr pvStructure = NTNDArray::createBuilder()->addTimeStamp()->createPVStructure();
+    DetectorImageRecord::shared_pointer pvRecord(new DetectorImageRecord(recordName, pvStructure, width, height));
+    if (!pvRecord->init())
+        pvRecord.reset();
+    return pvRecord;
+}
+
+DetectorImageRecord::DetectorImageRecord(string const & recordName, PVStructurePtr const & pvStructure,
+                                         size_t width, size_t height)
+: PVRecord(recordName, pvStructure), width(width), height(height), unique_id(0)
+{
+}
+
+bool DetectorImageRecord::init()
+{
+    initPVRecord();
+
+    PVStructurePtr pvStructure = getPVStructure();
+    if (!pvTimeStamp.attach(pvStructure->getSubField("timeStamp")))
+        return false;
+    if (!pvDataTimeStamp.attach(pvStructure->getSubField("dataTimeStamp")))
+        return false;
+
+    pvValue = pvStructure->getSubField<PVUnion>("value");
+    if (pvValue.get() == NULL)
+        return false;
+
+    pvUniqueId = pvStructure->getSubField<PVInt>("uniqueId");
+    if (pvUniqueId.get() == NULL)
+        return false;
+
+    pvCompressedSize = pvStructure->getSubField<PVLong>("compressedSize");
+    pvUncompressedSize = pvStructure->getSubField<PVLong>("uncompressedSize");
+    if (pvCompressedSize.get() == NULL  ||  pvUncompressedSize.get() == NULL)
+        return false;
+
+    // Dimensions and sizes don't change, set them once
+    setDimension();
+    int64 size = width * height * sizeof(float);
+    pvCompressedSize->put(size);
+    pvUncompressedSize->put(size);
+
+    return true;
+}
+
+void DetectorImageRecord::setDimension()
+{
+    PVStructureArrayPtr dimField = getPVStructure()->getSubField<PVStructureArray>("dimension");
+    PVStructureArray::svector dims(2);
+    const int32 sizes[] = { static_cast<int32>(width), static_cast<int32>(height) };
+    for (size_t i=0; i<2; ++i)
+    {
+        dims[i] = getPVDataCreate()->createPVStructure(dimField->getStructureArray()->getStructure());
+        dims[i]->getSubField<PVInt>("size")->put(sizes[i]);
+        dims[i]->getSubField<PVInt>("offset")->put(0);
+        dims[i]->getSubField<PVInt>("fullSize")->put(sizes[i]);
+        dims[i]->getSubField<PVInt>("binning")->put(1);
+        dims[i]->getSubField<PVBoolean>("reverse")->put(false);
+    }
+    dimField->replace(freeze(dims));
+}
+
+void DetectorImageRecord::process()
+{
+    timeStamp.getCurrent();
+    pvTimeStamp.set(timeStamp);
+    pvDataTimeStamp.set(timeStamp);
+}
+
+void DetectorImageRecord::update(shared_vector<const float> pixels)
+{
+    lock();
+    try
+    {
+        beginGroupPut();
+        pvValue->select<PVFloatArray>("floatValue")->replace(pixels);
+        pvValue->postPut();
+        pvUniqueId->put(unique_id++);
+        process();
+        endGroupPut();
+    }
+    catch(...)
+    {
+        unlock();
+        throw;
+    }
+    unlock();
+}
+#endif // USE_PVXS
+
+void SectionHistogram::add(const EventArray &pixel, size_t start, size_t end)
+{
+    const uint32_t *p = pixel.data();
+    const size_t bins = histogram.size();
+    uint32_t *h = &histogram[0];
+    for (size_t i=start; i<end; ++i)
+    {
+        // Pixel IDs outside of the image are ignored
+        if (p[i] < bins)
+            ++h[p[i]];
+    }
+}
+
+void SectionHistogram::mergeInto(std::vector<float> &image)
+{
+    for (size_t i=0; i<histogram.size(); ++i)
+        image[i] += histogram[i];
+    std::fill(histogram.begin(), histogram.end(), 0);
+}
+
+
+DetectorImage::DetectorImage(const std::string &record_name, size_t width, size_t height,
+                             size_t sections, double period, double decay)
+: width(width), height(height), period(period), decay(decay), reset_requested(false),
+  next_publish(epicsTime::getCurrent()), image(width * height, 0.0f), pool(WorkPool::getDefault())
+{
+#ifdef USE_PVXS
+    record = server::SharedPV::buildReadonly();
+    prototype = nt::NTNDArray{}.create();
+    shared_array<Value> dims(2);
+    const uint32_t sizes[] = { uint32_t(width), uint32_t(height) };
+    for (size_t i=0; i<2; ++i)
+    {
+        dims[i] = prototype["dimension"].allocMember();
+        dims[i]["size"] = sizes[i];
+        dims[i]["offset"] = 0;
+        dims[i]["fullSize"] = sizes[i];
+        dims[i]["binning"] = 1;
+        dims[i]["reverse"] = false;
+    }
+    prototype["dimension"] = dims.freeze();
+    prototype["compressedSize"] = width * height * sizeof(float);
+    prototype["uncompressedSize"] = width * height * sizeof(float);
+    unique_id = 0;
+    record.open(prototype);
+#else
+    record = DetectorImageRecord::create(record_name, width, height);
+#endif
+
+    if (sections < 1)
+        sections = 1;
+    for (size_t i=0; i<sections; ++i)
+        this->sections.push_back(std::shared_ptr<SectionHistogram>(new SectionHistogram(width * height)));
+}
+
+DetectorImage::~DetectorImage()
+{
+    shutdown();
+}
+
+void DetectorImage::addPulse(uint64_t id, double charge, EventArray tof, EventArray pixel)
+{
+    // Previous pulse needs to be done before a section can take the next one
+    pool.wait(pending);
+
+    // Split pixel array into sections, one task each.
+    // Tasks hold the pulse until they complete.
+    const size_t N = sections.size();
+    const size_t section = (pixel.size() + N - 1) / N;
+    for (size_t i=0; i<N; ++i)
+    {
+        size_t start = std::min(i * section, pixel.size());
+        size_t end = std::min(start + section, pixel.size());
+        std::shared_ptr<SectionHistogram> histogram = sections[i];
+        pool.submit(pending, [histogram, pixel, start, end]()
+        {
+            histogram->add(pixel, start, end);
+        });
+    }
+
+    epicsTime now = epicsTime::getCurrent();
+    if (now >= next_publish)
+    {
+        next_publish = now + period;
+        publish();
+    }
+}
+
+void DetectorImage::publish()
+{
+    if (reset_requested)
+    {
+        std::fill(image.begin(), image.end(), 0.0f);
+        reset_requested = false;
+    }
+    else if (decay < 1.0)
+    {
+        const float factor = decay;
+        for (size_t i=0; i<image.size(); ++i)
+            image[i] *= factor;
+    }
+
+    pool.wait(pending);
+    for (size_t i=0; i<sections.size(); ++i)
+        sections[i]->mergeInto(image);
+
+#ifdef USE_PVXS
+    shared_array<float> pixels(image.begin(), image.end());
+    Value update = prototype.cloneEmpty();
+    epicsTimeStamp now = epicsTime::getCurrent();
+    update["timeStamp.secondsPastEpoch"] = now.secPastEpoch;
+    update["timeStamp.nanoseconds"] = now.nsec;
+    update["dataTimeStamp.secondsPastEpoch"] = now.secPastEpoch;
+    update["dataTimeStamp.nanoseconds"] = now.nsec;
+    update["uniqueId"] = unique_id++;
+    update["value->floatValue"] = pixels.freeze();
+    record.post(std::move(update));
+#else
+    shared_vector<float> pixels(image.size());
+    std::copy(image.begin(), image.end(), pixels.begin());
+    record->update(freeze(pixels));
+#endif
+}
+
+void DetectorImage::setPeriod(double seconds)
+{   // No locking..
+    period = seconds;
+}
+
+void DetectorImage::setDecay(double decay)
+{   // No locking..
+    this->decay = decay;
+}
+
+void DetectorImage::reset()
+{   // No locking..
+    reset_requested = true;
+}
+
+void DetectorImage::shutdown()
+{
+    pool.wait(pending);
+}
+
+}} // namespace neutronServer, epics
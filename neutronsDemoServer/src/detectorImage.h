@@ -0,0 +1,166 @@
+/* detectorImage.h
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#ifndef DETECTORIMAGE_H
+#define DETECTORIMAGE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <workerRunnable.h>
+
+#include "neutronServer.h"
+
+#ifdef USE_PVXS
+#    include <pvxs/data.h>
+#    include <pvxs/sharedpv.h>
+#else
+#    include <pv/pvDatabase.h>
+#    include <pv/ntndarray.h>
+#    include <pv/timeStamp.h>
+#    include <pv/pvTimeStamp.h>
+#endif
+
+namespace epics { namespace neutronServer {
+
+#define NS_IMAGE_WIDTH   NS_DETECTOR_WIDTH  /** Detector image width */
+#define NS_IMAGE_HEIGHT  NS_DETECTOR_HEIGHT /** Detector image height */
+#define NS_IMAGE_SECTIONS 2 /** Number of pixel array sections that are histogrammed in parallel */
+
+#ifndef USE_PVXS
+/** NTNDArray record for the detector image
+ *
+ *  Publishes the image as 'floatValue' since counts
+ *  decay between updates.
+ */
+class DetectorImageRecord : public epics::pvDatabase::PVRecord
+{
+public:
+    POINTER_DEFINITIONS(DetectorImageRecord);
+
+    static DetectorImageRecord::shared_pointer create(std::string const & recordName,
+                                                      size_t width, size_t height);
+    virtual bool init();
+    virtual void process();
+
+    /** Update the image */
+    void update(epics::pvData::shared_vector<const float> pixels);
+
+private:
+    DetectorImageRecord(std::string const & recordName,
+                        epics::pvData::PVStructurePtr const & pvStructure,
+                        size_t width, size_t height);
+    void setDimension();
+
+    size_t width, height;
+    epics::pvData::int32 unique_id;
+
+    epics::pvData::TimeStamp   timeStamp;
+    epics::pvData::PVTimeStamp pvTimeStamp;
+    epics::pvData::PVTimeStamp pvDataTimeStamp;
+    epics::pvData::PVUnionPtr  pvValue;
+    epics::pvData::PVIntPtr    pvUniqueId;
+    epics::pvData::PVLongPtr   pvCompressedSize;
+    epics::pvData::PVLongPtr   pvUncompressedSize;
+};
+#endif // USE_PVXS
+
+/** Private histogram of pixel IDs for one section of each pulse's pixel array
+ *
+ *  Sections are histogrammed in parallel by WorkPool tasks.
+ *  The private histograms are only merged when the image is published,
+ *  so tasks never contend on the same bins.
+ */
+class SectionHistogram
+{
+public:
+    SectionHistogram(size_t bins)
+    : histogram(bins, 0)
+    {}
+
+    /** Add pixels[start, end) to the histogram */
+    void add(const EventArray &pixel, size_t start, size_t end);
+
+    /** Add private histogram to image, then clear it.
+     *  Must only be called when no task is adding to it.
+     */
+    void mergeInto(std::vector<float> &image);
+
+private:
+    std::vector<uint32_t> histogram;
+};
+
+/** Accumulates pixel hits of each pulse into a 2-D detector image
+ *
+ *  Pixels are histogrammed in parallel on the shared WorkPool, and the image is published
+ *  at a (lower) configurable rate.
+ *  On each publication, the previous image is multiplied by 'decay'
+ *  before adding the new counts:
+ *  1 keeps accumulating, 0 shows only the counts since the last update.
+ */
+class DetectorImage : public PulseConsumer
+{
+public:
+    DetectorImage(const std::string &record_name, size_t width, size_t height,
+                  size_t sections, double period, double decay);
+    ~DetectorImage();
+
+    /** Add pixels of a pulse. Called by the event generator thread */
+    void addPulse(uint64_t id, double charge, EventArray tof, EventArray pixel);
+
+    /** Set seconds between image updates */
+    void setPeriod(double seconds);
+
+    /** Set decay factor 0..1 */
+    void setDecay(double decay);
+
+    /** Clear the image on the next update */
+    void reset();
+
+    /** Wait for pending histogram tasks */
+    void shutdown();
+
+#ifdef USE_PVXS
+    pvxs::server::SharedPV& getRecord()
+    {
+        return record;
+    }
+#else
+    DetectorImageRecord::shared_pointer getRecord()
+    {
+        return record;
+    }
+#endif
+
+private:
+    void publish();
+
+#ifdef USE_PVXS
+    pvxs::server::SharedPV record;
+    pvxs::Value prototype;
+    uint32_t unique_id;
+#else
+    DetectorImageRecord::shared_pointer record;
+#endif
+    size_t width, height;
+    double period;
+    double decay;
+    bool reset_requested;
+    epicsTime next_publish;
+    std::vector<float> image;
+    WorkPool &pool;
+    /** Histogram tasks of the last pulse */
+    WorkGroup pending;
+    std::vector<std::shared_ptr<SectionHistogram> > sections;
+};
+
+}}
+
+#endif  /* DETECTORIMAGE_H */
@@ -0,0 +1,302 @@
+/* eventFilter.cpp
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <epicsMutex.h>
+#include <epicsGuard.h>
+#include "eventFilter.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#    include <immintrin.h>
+#    define NS_HAVE_AVX2_KERNEL
+#endif
+
+#ifndef USE_PVXS
+#   include <pv/pvData.h>
+#   include <pv/pvPlugin.h>
+    using namespace epics::pvData;
+    using namespace epics::pvCopy;
+#endif
+
+namespace epics { namespace neutronServer {
+
+bool EventFilter::parse(const std::string &spec)
+{
+    uint32_t *limits[] = { &tof_min, &tof_max, &pixel_min, &pixel_max };
+    std::istringstream items(spec);
+    std::string item;
+    size_t i = 0;
+    while (std::getline(items, item, ':'))
+    {
+        if (i >= 4)
+            return false;
+        if (! item.empty())
+        {
+            char *end;
+            unsigned long value = strtoul(item.c_str(), &end, 0);
+            if (*end != '\0')
+                return false;
+            *limits[i] = static_cast<uint32_t>(value);
+        }
+        ++i;
+    }
+    return i > 0;
+}
+
+bool EventFilter::operator<(const EventFilter &other) const
+{
+    if (tof_min != other.tof_min)
+        return tof_min < other.tof_min;
+    if (tof_max != other.tof_max)
+        return tof_max < other.tof_max;
+    if (pixel_min != other.pixel_min)
+        return pixel_min < other.pixel_min;
+    return pixel_max < other.pixel_max;
+}
+
+
+static size_t filterEventsScalar(const EventFilter &filter, const uint32_t *tof, const uint32_t *pixel, size_t count,
+                                 uint32_t *out_tof, uint32_t *out_pixel)
+{
+    // Branch-free: Always write, only advance when event passes
+    size_t n = 0;
+    for (size_t i=0; i<count; ++i)
+    {
+        out_tof[n] = tof[i];
+        out_pixel[n] = pixel[i];
+        n += (tof[i] >= filter.tof_min)  &  (tof[i] <= filter.tof_max)  &
+             (pixel[i] >= filter.pixel_min)  &  (pixel[i] <= filter.pixel_max);
+    }
+    return n;
+}
+
+#ifdef NS_HAVE_AVX2_KERNEL
+/** For each 8-bit mask, the lane indices of the set bits, in order */
+static uint32_t compaction_permutations[256][8];
+
+static void initCompactionPermutations()
+{
+    for (uint32_t mask=0; mask<256; ++mask)
+    {
+        uint32_t n = 0;
+        for (uint32_t lane=0; lane<8; ++lane)
+            if (mask & (1u << lane))
+                compaction_permutations[mask][n++] = lane;
+        while (n < 8)
+            compaction_permutations[mask][n++] = 0;
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __m256i inRange(__m256i value, __m256i low, __m256i high)
+{   // No unsigned compare in AVX2: value is in range if max(value, low) == value == min(value, high)
+    return _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_max_epu32(value, low), value),
+                            _mm256_cmpeq_epi32(_mm256_min_epu32(value, high), value));
+}
+
+/** Compact 8 events at a time:
+ *  Compute mask, permute the passing lanes to the front,
+ *  store all 8 lanes and advance by the number that passed.
+ */
+__attribute__((target("avx2,popcnt")))
+static size_t filterEventsAVX2(const EventFilter &filter, const uint32_t *tof, const uint32_t *pixel, size_t count,
+                               uint32_t *out_tof, uint32_t *out_pixel)
+{
+    const __m256i tof_min = _mm256_set1_epi32(filter.tof_min);
+    const __m256i tof_max = _mm256_set1_epi32(filter.tof_max);
+    const __m256i pixel_min = _mm256_set1_epi32(filter.pixel_min);
+    const __m256i pixel_max = _mm256_set1_epi32(filter.pixel_max);
+    size_t n = 0, i = 0;
+    for (/**/; i+8 <= count; i += 8)
+    {
+        __m256i t = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(tof + i));
+        __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pixel + i));
+        __m256i pass = _mm256_and_si256(inRange(t, tof_min, tof_max), inRange(p, pixel_min, pixel_max));
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(pass));
+        __m256i perm = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(compaction_permutations[mask]));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out_tof + n), _mm256_permutevar8x32_epi32(t, perm));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out_pixel + n), _mm256_permutevar8x32_epi32(p, perm));
+        n += _mm_popcnt_u32(mask);
+    }
+    return n + filterEventsScalar(filter, tof + i, pixel + i, count - i, out_tof + n, out_pixel + n);
+}
+#endif
+
+size_t filterEvents(const EventFilter &filter, const uint32_t *tof, const uint32_t *pixel, size_t count,
+                    uint32_t *out_tof, uint32_t *out_pixel)
+{
+#ifdef NS_HAVE_AVX2_KERNEL
+    static const bool have_avx2 = __builtin_cpu_supports("avx2")  &&  __builtin_cpu_supports("popcnt");
+    if (have_avx2)
+    {
+        static bool initialized = (initCompactionPermutations(), true);
+        (void) initialized;
+        return filterEventsAVX2(filter, tof, pixel, count, out_tof, out_pixel);
+    }
+#endif
+    return filterEventsScalar(filter, tof, pixel, count, out_tof, out_pixel);
+}
+
+
+#ifndef USE_PVXS
+// --------------------------------------------------------------------------------------------
+// pvRequest plugin
+//
+// PVCopy calls the filter of each subscription for the time_of_flight and pixel
+// fields when the record changes. Filtered arrays are cached per distinct filter,
+// so the first subscription with a filter computes them, all others share them.
+// --------------------------------------------------------------------------------------------
+
+#define NS_FILTER_CACHE_MAX 32 /** Max number of distinct filters to cache */
+
+/** Filtered events of the most recent pulse for one filter */
+struct FilteredEvents
+{
+    /** TOF array of the pulse that was filtered.
+     *  Holding on to it prevents a new pulse from re-using its memory
+     */
+    shared_vector<const uint32> source;
+    shared_vector<const uint32> tof, pixel;
+};
+
+class EventFilterCache
+{
+public:
+    static EventFilterCache& getInstance()
+    {
+        static EventFilterCache instance;
+        return instance;
+    }
+
+    /** Get filtered events, computing them once per pulse and filter */
+    void get(const EventFilter &filter, shared_vector<const uint32> const &tof, shared_vector<const uint32> const &pixel,
+             shared_vector<const uint32> &filtered_tof, shared_vector<const uint32> &filtered_pixel);
+
+private:
+    epicsMutex mutex;
+    std::map<EventFilter, FilteredEvents> cache;
+};
+
+void EventFilterCache::get(const EventFilter &filter, shared_vector<const uint32> const &tof, shared_vector<const uint32> const &pixel,
+                           shared_vector<const uint32> &filtered_tof, shared_vector<const uint32> &filtered_pixel)
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    std::map<EventFilter, FilteredEvents>::iterator entry = cache.find(filter);
+    if (entry == cache.end())
+    {   // Stale filters of past subscriptions only hold one pulse, but don't keep too many
+        if (cache.size() >= NS_FILTER_CACHE_MAX)
+            cache.clear();
+        entry = cache.insert(std::make_pair(filter, FilteredEvents())).first;
+    }
+    FilteredEvents &events = entry->second;
+    if (events.source.data() != tof.data()  ||  events.source.size() != tof.size())
+    {
+        size_t count = std::min(tof.size(), pixel.size());
+        shared_vector<uint32> out_tof(count + NS_FILTER_PADDING), out_pixel(count + NS_FILTER_PADDING);
+        size_t passed = filterEvents(filter, tof.data(), pixel.data(), count, out_tof.data(), out_pixel.data());
+        out_tof.resize(passed);
+        out_pixel.resize(passed);
+        events.source = tof;
+        events.tof = freeze(out_tof);
+        events.pixel = freeze(out_pixel);
+    }
+    filtered_tof = events.tof;
+    filtered_pixel = events.pixel;
+}
+
+/** Filter for the time_of_flight or pixel field of one subscription */
+class EventFilterPVFilter : public PVFilter
+{
+public:
+    EventFilterPVFilter(const EventFilter &event_filter, PVUIntArrayPtr const &master_tof,
+                        PVUIntArrayPtr const &master_pixel, bool is_tof)
+    : event_filter(event_filter), master_tof(master_tof), master_pixel(master_pixel), is_tof(is_tof)
+    {}
+
+    bool filter(const PVFieldPtr & pvCopy, const BitSetPtr & bitSet, bool toCopy);
+
+    std::string getName()
+    {
+        return "neutronFilter";
+    }
+
+private:
+    EventFilter event_filter;
+    PVUIntArrayPtr master_tof, master_pixel;
+    bool is_tof;
+};
+
+bool EventFilterPVFilter::filter(const PVFieldPtr & pvCopy, const BitSetPtr & bitSet, bool toCopy)
+{
+    // Filtered events can't be written back
+    if (! toCopy)
+        return false;
+    PVUIntArrayPtr copy = std::tr1::dynamic_pointer_cast<PVUIntArray>(pvCopy);
+    if (! copy)
+        return false;
+
+    shared_vector<const uint32> tof, pixel;
+    EventFilterCache::getInstance().get(event_filter, master_tof->view(), master_pixel->view(), tof, pixel);
+    copy->replace(is_tof ? tof : pixel);
+    bitSet->set(pvCopy->getFieldOffset());
+    return true;
+}
+
+/** Plugin that creates filters for "time_of_flight.value[neutronFilter=...]" and "pixel.value[neutronFilter=...]" */
+class EventFilterPlugin : public PVPlugin
+{
+public:
+    PVFilterPtr create(const std::string & requestValue, const PVCopyPtr & pvCopy, const PVFieldPtr & master);
+};
+
+PVFilterPtr EventFilterPlugin::create(const std::string & requestValue, const PVCopyPtr & pvCopy, const PVFieldPtr & master)
+{
+    EventFilter event_filter;
+    if (! event_filter.parse(requestValue))
+    {
+        std::cout << "neutronFilter: Expected 'tofMin:tofMax:pixelMin:pixelMax', got '" << requestValue << "'" << std::endl;
+        return PVFilterPtr();
+    }
+
+    // Need both arrays of the record, located relative to "time_of_flight.value" or "pixel.value"
+    PVStructure *parent = master->getParent();
+    PVStructure *top = parent ? parent->getParent() : 0;
+    if (! top)
+        return PVFilterPtr();
+    PVUIntArrayPtr master_tof = top->getSubField<PVUIntArray>("time_of_flight.value");
+    PVUIntArrayPtr master_pixel = top->getSubField<PVUIntArray>("pixel.value");
+    if (! master_tof  ||  ! master_pixel)
+    {
+        std::cout << "neutronFilter: Only applicable to neutron event records with uint[] arrays" << std::endl;
+        return PVFilterPtr();
+    }
+    bool is_tof = master == master_tof;
+    if (! is_tof  &&  master != master_pixel)
+    {
+        std::cout << "neutronFilter: Only applicable to time_of_flight.value and pixel.value" << std::endl;
+        return PVFilterPtr();
+    }
+
+    return PVFilterPtr(new EventFilterPVFilter(event_filter, master_tof, master_pixel, is_tof));
+}
+
+void registerEventFilterPlugin()
+{
+    static bool registered = false;
+    if (registered)
+        return;
+    registered = true;
+    PVPluginRegistry::registerPlugin("neutronFilter", PVPluginPtr(new EventFilterPlugin()));
+}
+#endif // USE_PVXS
+
+}} // namespace neutronServer, epics
@@ -0,0 +1,63 @@
+/* eventFilter.h
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#ifndef EVENTFILTER_H
+#define EVENTFILTER_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+
+namespace epics { namespace neutronServer {
+
+/** Event filter: Time-of-flight and pixel ID windows, inclusive */
+struct EventFilter
+{
+    uint32_t tof_min, tof_max, pixel_min, pixel_max;
+
+    EventFilter()
+    : tof_min(0), tof_max(UINT32_MAX), pixel_min(0), pixel_max(UINT32_MAX)
+    {}
+
+    /** Parse "tofMin:tofMax:pixelMin:pixelMax".
+     *  Empty or missing elements leave that limit open,
+     *  for example "1000:2000" or "::0:1023".
+     *  @return true on success
+     */
+    bool parse(const std::string &spec);
+
+    bool operator<(const EventFilter &other) const;
+};
+
+/** Stream-compact the events that pass the filter
+ *
+ *  Copies tof[i], pixel[i] for events within the filter windows into
+ *  out_tof, out_pixel, keeping their order.
+ *  Uses AVX2 when the CPU supports it.
+ *
+ *  @param out_tof, out_pixel Must have room for count + NS_FILTER_PADDING elements
+ *  @return Number of events that passed
+ */
+size_t filterEvents(const EventFilter &filter, const uint32_t *tof, const uint32_t *pixel, size_t count,
+                    uint32_t *out_tof, uint32_t *out_pixel);
+
+#define NS_FILTER_PADDING 8 /** Output arrays of filterEvents() may be written up to this many elements past the result */
+
+#ifndef USE_PVXS
+/** Register the 'neutronFilter' pvRequest plugin
+ *
+ *  Clients can then request filtered events via
+ *  "field(timeStamp,time_of_flight.value[neutronFilter=tofMin:tofMax:pixelMin:pixelMax],pixel.value[neutronFilter=...])".
+ *  All subscriptions with the same filter share the filtered arrays.
+ */
+void registerEventFilterPlugin();
+#endif
+
+}}
+
+#endif  /* EVENTFILTER_H */
@@ -0,0 +1,63 @@
+/* eventPublisher.h
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#ifndef EVENTPUBLISHER_H
+#define EVENTPUBLISHER_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <memory>
+
+namespace epics { namespace neutronServer {
+
+#define NS_TOF_MAX 160000 /** Maximum TOF value for the -r option (realistic data)*/
+#define NS_NARROW_TOF_SCALE ((NS_TOF_MAX + 65535) / 65536) /** TOF divisor for uint16 time-of-flight arrays */
+
+/** Events as published, uint32 elements or uint16 for the narrow layout
+ *
+ *  Refers to the memory of a frozen array, which is shared, not copied.
+ *  Independent of pvData or PVXS, so both backends can be built into one program.
+ */
+struct PublishedEvents
+{
+    std::shared_ptr<const void> data;
+    size_t count;
+    bool narrow;
+
+    PublishedEvents()
+    : count(0), narrow(false)
+    {}
+
+    PublishedEvents(const std::shared_ptr<const void> &data, size_t count, bool narrow)
+    : data(data), count(count), narrow(narrow)
+    {}
+};
+
+/** Publishes pulses as the neutron event record
+ *
+ *  Implemented for pvDatabase and PVXS.
+ *  Called by a single thread.
+ */
+class EventPublisher
+{
+public:
+    virtual ~EventPublisher() {}
+
+    /** @return Name of the backend */
+    virtual const char *getName() const = 0;
+
+    /** Publish a pulse */
+    virtual void publish(uint64_t id, double charge, const PublishedEvents &tof, const PublishedEvents &pixel) = 0;
+
+    /** Show publication statistics since the last report, then reset */
+    virtual void report() {}
+};
+
+}}
+
+#endif  /* EVENTPUBLISHER_H */
@@ -0,0 +1,245 @@
+/* eventRecorder.cpp
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <epicsGuard.h>
+#include "eventRecorder.h"
+
+namespace epics { namespace neutronServer {
+
+EventRecorder::EventRecorder(size_t queue_size)
+: queue_size(queue_size), report_period(0.0), data_fd(-1), index_fd(-1), is_running(true), failed(false),
+  buffer(0), buffered(0), offset(0),
+  dropped(0), written_pulses(0), written_bytes(0), reported_bytes(0)
+{
+}
+
+EventRecorder::~EventRecorder()
+{
+    if (data_fd >= 0)
+        close(data_fd);
+    if (index_fd >= 0)
+        close(index_fd);
+    free(buffer);
+}
+
+bool EventRecorder::init(const std::string &filename)
+{
+    void *aligned;
+    if (posix_memalign(&aligned, NS_RECORDER_ALIGN, NS_RECORDER_BLOCK))
+    {
+        std::cout << "Cannot allocate recorder buffer" << std::endl;
+        return false;
+    }
+    buffer = static_cast<char *>(aligned);
+
+    data_fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    std::string index_name = filename + ".idx";
+    index_fd = open(index_name.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (data_fd < 0  ||  index_fd < 0)
+    {
+        std::cout << "Cannot open recorder file '" << filename << "': " << strerror(errno) << std::endl;
+        return false;
+    }
+    // Appending to existing file: Index continues at current end
+    off_t end = lseek(data_fd, 0, SEEK_END);
+    offset = end > 0 ? end : 0;
+
+    last_report = epicsTime::getCurrent();
+    thread.reset(new epicsThread(*this, "recorder", epicsThreadGetStackSize(epicsThreadStackMedium),
+                                 epicsThreadPriorityLow));
+    thread->start();
+    return true;
+}
+
+void EventRecorder::addPulse(uint64_t id, double charge, EventArray tof, EventArray pixel)
+{
+    QueuedPulse pulse;
+    pulse.id = id;
+    pulse.time = epicsTime::getCurrent();
+    pulse.charge = charge;
+    pulse.tof = tof;
+    pulse.pixel = pixel;
+    {
+        epicsGuard<epicsMutex> guard(mutex);
+        if (queue.size() >= queue_size  ||  failed)
+        {
+            ++dropped;
+            return;
+        }
+        queue.push_back(pulse);
+    }
+    wakeup.signal();
+}
+
+void EventRecorder::run()
+{
+    while (true)
+    {
+        QueuedPulse pulse;
+        bool have_pulse = false;
+        {
+            epicsGuard<epicsMutex> guard(mutex);
+            if (! queue.empty())
+            {
+                pulse = queue.front();
+                queue.pop_front();
+                have_pulse = true;
+            }
+            else if (! is_running)
+                break;
+        }
+        if (have_pulse)
+        {
+            if (! failed)
+                writePulse(pulse);
+        }
+        else if (! wakeup.wait(1.0))
+            flush(); // Idle for a while, write what's buffered
+        report(false);
+    }
+    flush();
+    report(true);
+    thread_exited.signal();
+}
+
+void EventRecorder::writePulse(const QueuedPulse &pulse)
+{
+    size_t events = std::min(pulse.tof.size(), pulse.pixel.size());
+    RecordedPulse header;
+    header.magic = NS_RECORDER_MAGIC;
+    header.seconds_past_epoch = pulse.time.secPastEpoch;
+    header.nanoseconds = pulse.time.nsec;
+    header.pulse_id = pulse.id;
+    header.charge = pulse.charge;
+    header.events = events;
+
+    const size_t array_bytes = events * sizeof(uint32_t);
+    const size_t bytes = sizeof(header) + 2*array_bytes;
+    RecordedPulseIndex entry;
+    entry.pulse_id = pulse.id;
+    entry.offset = offset;
+
+    if (buffered + bytes > NS_RECORDER_BLOCK)
+        if (! flush())
+            return;
+    if (bytes <= NS_RECORDER_BLOCK)
+    {   // Collect in buffer, flush() adds the index entry once written
+        memcpy(buffer + buffered, &header, sizeof(header));
+        buffered += sizeof(header);
+        memcpy(buffer + buffered, pulse.tof.data(), array_bytes);
+        buffered += array_bytes;
+        memcpy(buffer + buffered, pulse.pixel.data(), array_bytes);
+        buffered += array_bytes;
+        offset += bytes;
+        index.push_back(entry);
+    }
+    else
+    {   // Large pulse, buffer is empty: Write arrays directly, no copy
+        if (! writeData(&header, sizeof(header))  ||
+            ! writeData(pulse.tof.data(), array_bytes)  ||
+            ! writeData(pulse.pixel.data(), array_bytes))
+            return;
+        offset += bytes;
+        index.push_back(entry);
+        if (! flush())
+            return;
+    }
+    ++written_pulses;
+}
+
+bool EventRecorder::writeData(const void *data, size_t bytes)
+{
+    const char *p = static_cast<const char *>(data);
+    while (bytes > 0)
+    {
+        ssize_t written = write(data_fd, p, bytes);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            std::cout << "Recorder write error: " << strerror(errno) << std::endl;
+            epicsGuard<epicsMutex> guard(mutex);
+            failed = true;
+            return false;
+        }
+        p += written;
+        bytes -= written;
+        written_bytes += written;
+    }
+    return true;
+}
+
+bool EventRecorder::flush()
+{
+    // After an error, the data file may end in a partial pulse. Don't index it.
+    if (failed)
+        return false;
+    if (buffered > 0)
+    {
+        if (! writeData(buffer, buffered))
+            return false;
+        buffered = 0;
+    }
+    // Data is written, now add the index entries
+    if (! index.empty())
+    {
+        size_t bytes = index.size() * sizeof(RecordedPulseIndex);
+        if (write(index_fd, &index[0], bytes) != (ssize_t) bytes)
+        {
+            std::cout << "Recorder index write error: " << strerror(errno) << std::endl;
+            epicsGuard<epicsMutex> guard(mutex);
+            failed = true;
+            return false;
+        }
+        index.clear();
+    }
+    return true;
+}
+
+void EventRecorder::report(bool final)
+{
+    epicsTime now = epicsTime::getCurrent();
+    double seconds = now - last_report;
+    if (! final  &&  (report_period <= 0  ||  seconds < report_period))
+        return;
+    uint64_t drops;
+    size_t queued;
+    {
+        epicsGuard<epicsMutex> guard(mutex);
+        drops = dropped;
+        dropped = 0;
+        queued = queue.size();
+    }
+    std::cout << "Recorder: " << written_pulses << " pulses, "
+              << (seconds > 0 ? (written_bytes - reported_bytes) / seconds / 1e6 : 0.0) << " MB/s, "
+              << drops << " dropped, " << queued << " queued" << std::endl;
+    written_pulses = 0;
+    reported_bytes = written_bytes;
+    last_report = now;
+}
+
+void EventRecorder::shutdown()
+{
+    if (! thread)
+        return;
+    {
+        epicsGuard<epicsMutex> guard(mutex);
+        is_running = false;
+    }
+    wakeup.signal();
+    thread_exited.wait(10.0);
+}
+
+}} // namespace neutronServer, epics
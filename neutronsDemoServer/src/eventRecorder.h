@@ -0,0 +1,128 @@
+/* eventRecorder.h
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#ifndef EVENTRECORDER_H
+#define EVENTRECORDER_H
+
+#include <stdint.h>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+
+#include "neutronServer.h"
+
+namespace epics { namespace neutronServer {
+
+#define NS_RECORDER_QUEUE 100             /** Max. number of pulses waiting to be written */
+#define NS_RECORDER_BLOCK (4*1024*1024)   /** Size of write buffer, bytes */
+#define NS_RECORDER_ALIGN 4096            /** Alignment of write buffer */
+#define NS_RECORDER_MAGIC 0x4E455652      /** 'NEVR', start of each pulse in data file */
+
+/** Pulse in the data file, followed by 'events' time-of-flight values, then 'events' pixel IDs */
+struct RecordedPulse
+{
+    uint32_t magic;
+    uint32_t nanoseconds;
+    uint64_t seconds_past_epoch;
+    uint64_t pulse_id;
+    double charge;
+    uint64_t events;
+};
+
+/** Entry in the index file, one per pulse */
+struct RecordedPulseIndex
+{
+    uint64_t pulse_id;
+    /** Offset of RecordedPulse in data file */
+    uint64_t offset;
+};
+
+/** Records all pulses to disk
+ *
+ *  Pulses are queued by reference to the frozen arrays, no copy,
+ *  and written by a separate thread so that the pulse timing is not affected.
+ *  If the queue is full because the disk cannot keep up, pulses are dropped.
+ *
+ *  The data file 'filename' is append-only.
+ *  'filename.idx' lists the pulse ID and data file offset of each pulse.
+ *  Index entries are only written after the corresponding data
+ *  has been written completely.
+ *  Statistics are shown on shutdown, and periodically if requested.
+ */
+class EventRecorder : public PulseConsumer, public epicsThreadRunable
+{
+public:
+    EventRecorder(size_t queue_size = NS_RECORDER_QUEUE);
+    ~EventRecorder();
+
+    /** Show statistics at this period, 0 to only show them on shutdown.
+     *  Call before init()
+     */
+    void setReportPeriod(double seconds)
+    {
+        report_period = seconds;
+    }
+
+    /** Open files and start writer thread
+     *  @return true on success
+     */
+    bool init(const std::string &filename);
+
+    /** Queue pulse for writing */
+    void addPulse(uint64_t id, double charge, EventArray tof, EventArray pixel);
+
+    /** Write remaining pulses, close files */
+    void shutdown();
+
+    void run();
+
+private:
+    struct QueuedPulse
+    {
+        uint64_t id;
+        epicsTimeStamp time;
+        double charge;
+        EventArray tof, pixel;
+    };
+
+    void writePulse(const QueuedPulse &pulse);
+    bool writeData(const void *data, size_t bytes);
+    bool flush();
+    void report(bool final);
+
+    size_t queue_size;
+    double report_period;
+    int data_fd, index_fd;
+    std::shared_ptr<epicsThread> thread;
+    epicsMutex mutex;
+    epicsEvent wakeup;
+    epicsEvent thread_exited;
+    std::deque<QueuedPulse> queue;
+    bool is_running;
+    bool failed;
+
+    // Write buffer and index entries for its data
+    char *buffer;
+    size_t buffered;
+    uint64_t offset;
+    std::vector<RecordedPulseIndex> index;
+
+    // Statistics, 'dropped' is protected by mutex
+    uint64_t dropped;
+    uint64_t written_pulses, written_bytes, reported_bytes;
+    epicsTime last_report;
+};
+
+}}
+
+#endif  /* EVENTRECORDER_H */
@@ -0,0 +1,152 @@
+/* iocServer.cpp
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#include <iostream>
+#include <vector>
+#include <epicsExit.h>
+#include <epicsMutex.h>
+#include <epicsGuard.h>
+#include <dbAccess.h>
+#include <initHooks.h>
+#include "iocServer.h"
+
+#ifdef USE_PVXS
+#   include <pvxs/iochooks.h>
+#endif
+
+namespace epics { namespace neutronServer {
+
+/** Records and generators of the IOC, cleaned up on exit */
+struct IOCResources
+{
+    epicsMutex mutex;
+    std::vector<std::string> names;
+#ifdef USE_PVXS
+    std::vector<pvxs::server::SharedPV> records;
+#else
+    std::vector<epics::pvDatabase::PVRecordPtr> records;
+#endif
+    std::vector<std::shared_ptr<FakeNeutronEventRunnable> > runnables;
+    std::vector<std::shared_ptr<epicsThread> > threads;
+};
+
+/** Created on first use, never deleted since threads may use it until exit */
+static IOCResources *getResources()
+{
+    static IOCResources *resources = new IOCResources();
+    return resources;
+}
+
+/** epicsAtExit handler: Stop generators, then remove their records
+ *
+ *  Registered once the IOC is running, after the PVXS server's own
+ *  exit handler, so it runs before that server stops.
+ */
+static void iocCleanup(void *arg)
+{
+    IOCResources *resources = static_cast<IOCResources *>(arg);
+    epicsGuard<epicsMutex> guard(resources->mutex);
+    for (size_t i=0; i<resources->runnables.size(); ++i)
+        resources->runnables[i]->shutdown();
+    resources->runnables.clear();
+    resources->threads.clear();
+    for (size_t i=0; i<resources->records.size(); ++i)
+    {
+#ifdef USE_PVXS
+        // Must not throw out of the exit handler
+        try
+        {
+            pvxs::ioc::server().removePV(resources->names[i]);
+            resources->records[i].close();
+        }
+        catch (std::exception &ex)
+        {
+            std::cout << "Cannot remove record '" << resources->names[i] << "': " << ex.what() << std::endl;
+        }
+#else
+        epics::pvDatabase::PVDatabase::getMaster()->removeRecord(resources->records[i]);
+#endif
+    }
+    resources->records.clear();
+    resources->names.clear();
+}
+
+/** Register iocCleanup when the IOC is running */
+static void cleanupInitHook(initHookState state)
+{
+    if (state == initHookAfterIocRunning)
+        epicsAtExit(iocCleanup, getResources());
+}
+
+/** Register iocCleanup once
+ *
+ *  Records are typically added before or during iocInit,
+ *  i.e. before the PVXS server registers its exit handler.
+ *  epicsAtExit handlers run last-in, first-out,
+ *  so iocCleanup is only registered once the IOC is running.
+ */
+static void registerCleanup(IOCResources *resources)
+{
+    static bool registered = false;
+    if (registered)
+        return;
+    registered = true;
+    if (interruptAccept)
+        epicsAtExit(iocCleanup, resources);
+    else
+        initHookRegister(cleanupInitHook);
+}
+
+#ifdef USE_PVXS
+bool iocAddRecord(const std::string &name, pvxs::server::SharedPV &record)
+{
+    IOCResources *resources = getResources();
+    epicsGuard<epicsMutex> guard(resources->mutex);
+    try
+    {
+        pvxs::ioc::server().addPV(name, record);
+    }
+    catch (std::exception &ex)
+    {
+        std::cout << "Cannot serve record '" << name << "': " << ex.what() << std::endl;
+        return false;
+    }
+    resources->names.push_back(name);
+    resources->records.push_back(record);
+    registerCleanup(resources);
+    return true;
+}
+#else
+bool iocAddRecord(const std::string &name, epics::pvDatabase::PVRecordPtr record)
+{
+    IOCResources *resources = getResources();
+    epicsGuard<epicsMutex> guard(resources->mutex);
+    if (! epics::pvDatabase::PVDatabase::getMaster()->addRecord(record))
+    {
+        std::cout << "Cannot create record '" << name << "'" << std::endl;
+        return false;
+    }
+    resources->names.push_back(name);
+    resources->records.push_back(record);
+    registerCleanup(resources);
+    return true;
+}
+#endif
+
+void iocStartRunnable(std::shared_ptr<FakeNeutronEventRunnable> runnable, const char *thread_name)
+{
+    IOCResources *resources = getResources();
+    epicsGuard<epicsMutex> guard(resources->mutex);
+    std::shared_ptr<epicsThread> thread(new epicsThread(*runnable, thread_name, epicsThreadGetStackSize(epicsThreadStackMedium)));
+    resources->runnables.push_back(runnable);
+    resources->threads.push_back(thread);
+    registerCleanup(resources);
+    thread->start();
+}
+
+}} // namespace neutronServer, epics
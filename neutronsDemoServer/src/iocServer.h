@@ -0,0 +1,43 @@
+/* iocServer.h
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#ifndef IOCSERVER_H
+#define IOCSERVER_H
+
+#include <memory>
+#include <string>
+#include "neutronServer.h"
+
+namespace epics { namespace neutronServer {
+
+/** Serve a record from the IOC
+ *
+ *  With pvDatabase, the record is added to the master database
+ *  which the IOC serves via startPVAServer.
+ *  With PVXS, the record is added to the PVXS server of the IOC,
+ *  see pvxsIoc.dbd, which starts with iocInit and stops when the IOC exits.
+ *
+ *  Call from the IOC shell or device support before iocInit completes.
+ *  @return true on success
+ */
+#ifdef USE_PVXS
+bool iocAddRecord(const std::string &name, pvxs::server::SharedPV &record);
+#else
+bool iocAddRecord(const std::string &name, epics::pvDatabase::PVRecordPtr record);
+#endif
+
+/** Run event generator in a new thread
+ *
+ *  When the IOC exits, the generator is stopped
+ *  and records added via iocAddRecord are removed.
+ */
+void iocStartRunnable(std::shared_ptr<FakeNeutronEventRunnable> runnable, const char *thread_name);
+
+}}
+
+#endif  /* IOCSERVER_H */
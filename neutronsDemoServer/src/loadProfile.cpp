@@ -0,0 +1,184 @@
+/* loadProfile.cpp
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "loadProfile.h"
+
+namespace epics { namespace neutronServer {
+
+double LoadPhase::getScale(double time) const
+{
+    switch (kind)
+    {
+    case RAMP:
+        if (duration <= 0)
+            return to;
+        return from + (to - from) * std::min(time / duration, 1.0);
+    case BURST:
+        if (period <= 0)
+            return from;
+        return fmod(time, period) < duty * period ? from : to;
+    case TRIP:
+        return 0.0;
+    case STEADY:
+    default:
+        return from;
+    }
+}
+
+std::string LoadPhase::toString() const
+{
+    std::ostringstream buf;
+    switch (kind)
+    {
+    case RAMP:
+        buf << "ramp " << duration << " s, " << from << " .. " << to;
+        break;
+    case BURST:
+        buf << "burst " << duration << " s, " << from << "/" << to
+            << " every " << period << " s, duty " << duty;
+        break;
+    case TRIP:
+        buf << "trip " << duration << " s";
+        break;
+    case STEADY:
+    default:
+        buf << "steady " << duration << " s, " << from;
+    }
+    return buf.str();
+}
+
+LoadProfile::LoadProfile()
+: total_duration(0.0), repeat(false)
+{
+}
+
+bool LoadProfile::parseLine(const std::string &line, const std::string &source)
+{
+    std::string text(line);
+    size_t comment = text.find('#');
+    if (comment != std::string::npos)
+        text.erase(comment);
+    std::istringstream items(text);
+    std::string kind;
+    if (! (items >> kind))
+        return true; // Empty line
+
+    if (kind == "repeat")
+    {
+        repeat = true;
+        return true;
+    }
+
+    LoadPhase phase;
+    phase.duration = 0.0;
+    phase.from = phase.to = 1.0;
+    phase.period = phase.duty = 0.0;
+    bool ok;
+    if (kind == "steady")
+    {
+        phase.kind = LoadPhase::STEADY;
+        ok = ! (items >> phase.duration >> phase.from).fail();
+        phase.to = phase.from;
+    }
+    else if (kind == "ramp")
+    {
+        phase.kind = LoadPhase::RAMP;
+        ok = ! (items >> phase.duration >> phase.from >> phase.to).fail();
+    }
+    else if (kind == "burst")
+    {
+        phase.kind = LoadPhase::BURST;
+        ok = ! (items >> phase.duration >> phase.from >> phase.to >> phase.period >> phase.duty).fail()
+             &&  phase.duty >= 0  &&  phase.duty <= 1;
+    }
+    else if (kind == "trip")
+    {
+        phase.kind = LoadPhase::TRIP;
+        ok = ! (items >> phase.duration).fail();
+        phase.from = phase.to = 0.0;
+    }
+    else
+        ok = false;
+
+    if (! ok  ||  phase.duration < 0  ||  phase.from < 0  ||  phase.to < 0)
+    {
+        std::cout << source << ": Invalid load profile phase '" << line << "'" << std::endl;
+        return false;
+    }
+    phases.push_back(phase);
+    total_duration += phase.duration;
+    return true;
+}
+
+bool LoadProfile::parse(const std::string &spec)
+{
+    phases.clear();
+    total_duration = 0.0;
+    repeat = false;
+    std::string line;
+    std::istringstream lines(spec);
+    while (std::getline(lines, line, ';'))
+    {
+        std::string part;
+        std::istringstream parts(line);
+        while (std::getline(parts, part))
+            if (! parseLine(part, "Load profile"))
+                return false;
+    }
+    if (phases.empty())
+    {
+        std::cout << "Empty load profile" << std::endl;
+        return false;
+    }
+    if (repeat  &&  total_duration <= 0)
+    {
+        std::cout << "Repeated load profile needs a duration" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool LoadProfile::load(const std::string &filename)
+{
+    std::ifstream file(filename.c_str());
+    if (! file)
+    {
+        std::cout << "Cannot open load profile '" << filename << "'" << std::endl;
+        return false;
+    }
+    std::ostringstream text;
+    text << file.rdbuf();
+    return parse(text.str());
+}
+
+double LoadProfile::getScale(double elapsed, size_t &phase) const
+{
+    if (phases.empty())
+    {
+        phase = 0;
+        return 1.0;
+    }
+    if (repeat)
+        elapsed = fmod(elapsed, total_duration);
+    for (phase=0; phase<phases.size(); ++phase)
+    {
+        if (elapsed < phases[phase].duration)
+            return phases[phase].getScale(elapsed);
+        elapsed -= phases[phase].duration;
+    }
+    // Past the end: Remain at final value of last phase
+    phase = phases.size() - 1;
+    return phases[phase].getScale(phases[phase].duration);
+}
+
+}} // namespace neutronServer, epics
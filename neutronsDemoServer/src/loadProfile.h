@@ -0,0 +1,100 @@
+/* loadProfile.h
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#ifndef LOADPROFILE_H
+#define LOADPROFILE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace epics { namespace neutronServer {
+
+/** One phase of a load profile */
+struct LoadPhase
+{
+    enum Kind { STEADY, RAMP, BURST, TRIP };
+
+    Kind kind;
+    /** Duration of the phase in seconds */
+    double duration;
+    /** STEADY: 'from' is the scale.
+     *  RAMP: Scale changes linearly 'from' .. 'to'.
+     *  BURST: Scale 'from' for 'duty' * 'period' seconds, then 'to' for the rest of each period.
+     *  TRIP: No beam, scale 0.
+     */
+    double from, to;
+    double period, duty;
+
+    /** @return Scale factor at 'time' seconds into the phase */
+    double getScale(double time) const;
+
+    /** @return Description of phase */
+    std::string toString() const;
+};
+
+/** Beam power profile over time
+ *
+ *  Scales the event count of each pulse
+ *  to simulate ramp-up, beam trips and bursts.
+ *
+ *  Phases are listed one per line in a file,
+ *  or separated by ';' on the command line:
+ *
+ *     steady duration scale
+ *     ramp   duration from to
+ *     burst  duration high low period duty
+ *     trip   duration
+ *     repeat
+ *
+ *  for example "ramp 10 0 1; steady 20 1; trip 2; burst 10 1 0.1 1 0.2; repeat".
+ *  Without 'repeat', the final scale of the last phase is kept.
+ */
+class LoadProfile
+{
+public:
+    LoadProfile();
+
+    /** Parse profile from text, phases separated by ';' or newlines
+     *  @return true on success
+     */
+    bool parse(const std::string &spec);
+
+    /** Load profile from file
+     *  @return true on success
+     */
+    bool load(const std::string &filename);
+
+    size_t getPhaseCount() const
+    {
+        return phases.size();
+    }
+
+    const LoadPhase &getPhase(size_t index) const
+    {
+        return phases[index];
+    }
+
+    /** Get scale factor for the pulse count
+     *  @param elapsed Seconds since start of profile
+     *  @param phase Set to index of the active phase
+     *  @return Scale factor, 1.0 for full beam power
+     */
+    double getScale(double elapsed, size_t &phase) const;
+
+private:
+    bool parseLine(const std::string &line, const std::string &source);
+
+    std::vector<LoadPhase> phases;
+    double total_duration;
+    bool repeat;
+};
+
+}}
+
+#endif  /* LOADPROFILE_H */
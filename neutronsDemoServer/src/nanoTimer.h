@@ -10,7 +10,10 @@
 #define __NANO_TIMER_H__
 
 #include <sys/time.h>
+#include <stdint.h>
+#include <algorithm>
 #include <iostream>
+#include <vector>
 
 class NanoTimer
 {
@@ -37,6 +40,18 @@ public:
         ++total_runs;
     }
 
+    /** @return Total nanoseconds of all runs */
+    uint64_t getTotalNanosecs() const
+    {
+        return total_ns;
+    }
+
+    /** @return Number of runs */
+    uint64_t getRuns() const
+    {
+        return total_runs;
+    }
+
     uint64_t getAverageNanosecs() const
     {
         if (total_runs <= 0)
@@ -52,7 +67,47 @@ public:
     }
 };
 
-std::ostream& operator<<(std::ostream& out, const NanoTimer& timer)
+/** Collects latency samples to determine percentiles */
+class LatencyStats
+{
+    std::vector<uint64_t> samples;
+
+public:
+    void add(uint64_t ns)
+    {
+        samples.push_back(ns);
+    }
+
+    size_t getCount() const
+    {
+        return samples.size();
+    }
+
+    /** @param percent 0..100
+     *  @return Latency in nanoseconds below which 'percent' of the samples fall
+     */
+    uint64_t getPercentile(double percent) const
+    {
+        if (samples.empty())
+            return 0;
+        std::vector<uint64_t> sorted(samples);
+        size_t index = static_cast<size_t>(percent / 100.0 * (sorted.size() - 1) + 0.5);
+        std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+        return sorted[index];
+    }
+
+    uint64_t getMax() const
+    {
+        return samples.empty() ? 0 : *std::max_element(samples.begin(), samples.end());
+    }
+
+    void clear()
+    {
+        samples.clear();
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& out, const NanoTimer& timer)
 {
     double avg = timer.getAverageNanosecs();
     if (avg < 1000.0)
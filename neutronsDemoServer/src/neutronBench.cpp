@@ -0,0 +1,160 @@
+/* neutronBench.cpp
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <vector>
+#include <sys/resource.h>
+
+#include <epicsGuard.h>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+
+#include "neutronBench.h"
+#include "neutronServer.h"
+#include "iocServer.h"
+#include "nanoTimer.h"
+
+namespace epics { namespace neutronServer {
+
+/** Publisher that times each publish() of another publisher */
+class TimedPublisher : public EventPublisher
+{
+public:
+    TimedPublisher(std::shared_ptr<EventPublisher> target)
+    : target(target)
+    {}
+
+    const char *getName() const
+    {
+        return target->getName();
+    }
+
+    void publish(uint64_t id, double charge, const PublishedEvents &tof, const PublishedEvents &pixel)
+    {
+        uint64_t start = NanoTimer::getCurrentNanosecs();
+        target->publish(id, charge, tof, pixel);
+        uint64_t ns = NanoTimer::getCurrentNanosecs() - start;
+        epicsGuard<epicsMutex> guard(mutex);
+        latency.add(ns);
+    }
+
+    void report()
+    {
+        target->report();
+    }
+
+    /** Get post latency statistics, then clear them */
+    void fetch(LatencyStats &latency)
+    {
+        epicsGuard<epicsMutex> guard(mutex);
+        latency = this->latency;
+        this->latency.clear();
+    }
+
+private:
+    std::shared_ptr<EventPublisher> target;
+    epicsMutex mutex;
+    LatencyStats latency;
+};
+
+/** @return Comma-separated numbers, skipping invalid entries */
+static std::vector<size_t> parseList(const std::string &text)
+{
+    std::vector<size_t> values;
+    std::stringstream items(text);
+    std::string item;
+    while (std::getline(items, item, ','))
+    {
+        long value = atol(item.c_str());
+        if (value > 0)
+            values.push_back(static_cast<size_t>(value));
+    }
+    return values;
+}
+
+/** @return User and system CPU seconds of this process */
+static double getCPUSeconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+}
+
+/** Publisher of the benchmark record, served once and re-used by all runs */
+static std::shared_ptr<RecordPublisher> getBenchRecord()
+{
+    static std::shared_ptr<RecordPublisher> record;
+    if (! record)
+    {
+#ifdef USE_PVXS
+        record.reset(new PVXSPublisher());
+#else
+        record.reset(new PVDatabasePublisher(NS_BENCH_RECORD_NAME));
+#endif
+        iocAddRecord(NS_BENCH_RECORD_NAME, record->getRecord());
+    }
+    return record;
+}
+
+void neutronBench(double seconds, const std::string &counts, const std::string &threads)
+{
+    std::vector<size_t> event_counts = parseList(counts);
+    std::vector<size_t> thread_counts = parseList(threads);
+    if (seconds <= 0)
+        seconds = 5.0;
+    if (event_counts.empty())
+        event_counts.push_back(100000);
+    if (thread_counts.empty())
+        thread_counts.push_back(2);
+
+    std::shared_ptr<TimedPublisher> publisher(new TimedPublisher(getBenchRecord()));
+
+    std::cout << "    events threads    pulses/s   Mevents/s   p50 us   p99 us  fill us  CPU ms/pulse" << std::endl;
+    for (size_t c=0; c<event_counts.size(); ++c)
+        for (size_t t=0; t<thread_counts.size(); ++t)
+        {
+            // Back-to-back pulses to find the sustainable rate
+            std::shared_ptr<FakeNeutronEventRunnable> runnable(
+                new FakeNeutronEventRunnable(NS_BENCH_RECORD_NAME, 0.0, event_counts[c], false, false, 0));
+            runnable->setThreads(thread_counts[t]);
+            runnable->setPublisher(publisher);
+            epicsThread thread(*runnable, "neutronBench", epicsThreadGetStackSize(epicsThreadStackMedium));
+
+            LatencyStats latency;
+            publisher->fetch(latency);
+
+            double cpu = getCPUSeconds();
+            epicsTime start = epicsTime::getCurrent();
+            thread.start();
+            epicsThreadSleep(seconds);
+            runnable->shutdown();
+            double elapsed = epicsTime::getCurrent() - start;
+            cpu = getCPUSeconds() - cpu;
+
+            publisher->fetch(latency);
+            NeutronStatistics stats = runnable->getStatistics();
+            double pulses = static_cast<double>(stats.packets);
+            std::cout << std::setw(10) << event_counts[c]
+                      << std::setw(8) << thread_counts[t]
+                      << std::setw(12) << pulses / elapsed
+                      << std::setw(12) << pulses * event_counts[c] / elapsed / 1e6
+                      << std::setw(9) << latency.getPercentile(50) / 1000
+                      << std::setw(9) << latency.getPercentile(99) / 1000
+                      << std::setw(9) << (stats.fill_runs > 0 ? stats.fill_ns / stats.fill_runs / 1000 : 0)
+                      << std::setw(14) << (pulses > 0 ? cpu * 1000.0 / pulses : 0.0)
+                      << std::endl;
+        }
+}
+
+}} // namespace neutronServer, epics
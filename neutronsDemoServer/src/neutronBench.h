@@ -0,0 +1,32 @@
+/* neutronBench.h
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#ifndef NEUTRONBENCH_H
+#define NEUTRONBENCH_H
+
+#include <string>
+
+namespace epics { namespace neutronServer {
+
+#define NS_BENCH_RECORD_NAME "neutrons:bench" /** Record that the IOC benchmark publishes */
+
+/** Benchmark the generator and publication path inside the IOC
+ *
+ *  For each event count and number of fill threads,
+ *  runs a generator back-to-back for 'seconds', publishing to NS_BENCH_RECORD_NAME,
+ *  and prints pulses/s, events/s, p50/p99 post latency, fill time and CPU per pulse.
+ *  CPU is that of the whole IOC process, including its other threads.
+ *
+ *  @param counts Comma-separated event counts, for example "1000,100000"
+ *  @param threads Comma-separated fill thread counts, for example "1,2"
+ */
+void neutronBench(double seconds, const std::string &counts, const std::string &threads);
+
+}}
+
+#endif  /* NEUTRONBENCH_H */
@@ -7,8 +7,13 @@
  * @author Kay Kasemir
  */
 #include <iostream>
+#include <map>
+#include <sstream>
+#include <vector>
 #include <getopt.h>
 
+#include <epicsGuard.h>
+#include <epicsMutex.h>
 #include <epicsThread.h>
 #include <epicsTime.h>
 #include <pv/epicsException.h>
@@ -18,6 +23,9 @@
 #include <pv/clientFactory.h>
 #include <pv/pvAccess.h>
 #include <pv/monitor.h>
+#include <pva/client.h>
+#include "udpTransport.h"
+#include "shmTransport.h"
 
 // #define TIME_IT
 #ifdef TIME_IT
@@ -206,15 +214,19 @@ void MyMonitorRequester::monitorConnect(Status const & status, MonitorPtr const
         }
         user_tag_offset = user_tag->getFieldOffset();
 
-        shared_ptr<PVUIntArray> tof = pvStructure->getSubField<PVUIntArray>("time_of_flight.value");
+        // Arrays may be uint[] or, for the narrow layout, ushort[]
+        shared_ptr<PVScalarArray> tof = pvStructure->getSubField<PVScalarArray>("time_of_flight.value");
         if (! tof)
         {
             cout << "No 'time_of_flight'" << endl;
             return;
         }
         tof_offset = tof->getFieldOffset();
+        shared_ptr<PVUInt> scale = pvStructure->getSubField<PVUInt>("time_of_flight.scale");
+        if (scale)
+            cout << "Narrow 'time_of_flight', scale " << scale->get() << endl;
 
-        shared_ptr<PVUIntArray> pixel = pvStructure->getSubField<PVUIntArray>("pixel.value");
+        shared_ptr<PVScalarArray> pixel = pvStructure->getSubField<PVScalarArray>("pixel.value");
         if (! pixel)
         {
             cout << "No 'pixel'" << endl;
@@ -319,14 +331,14 @@ void MyMonitorRequester::checkUpdate(shared_ptr<PVStructure> const &pvStructure)
     last_pulse_id = pulse_id;
 
     // Compare lengths of tof and pixel arrays
-    shared_ptr<PVUIntArray> tof = dynamic_pointer_cast<PVUIntArray>(pvStructure->getSubField(tof_offset));
+    shared_ptr<PVScalarArray> tof = dynamic_pointer_cast<PVScalarArray>(pvStructure->getSubField(tof_offset));
     if (!tof)
     {
         cout << "No 'time_of_flight' array" << endl;
         return;
     }
 
-    shared_ptr<PVUIntArray> pixel = dynamic_pointer_cast<PVUIntArray>(pvStructure->getSubField(pixel_offset));
+    shared_ptr<PVScalarArray> pixel = dynamic_pointer_cast<PVScalarArray>(pvStructure->getSubField(pixel_offset));
     if (!pixel)
     {
         cout << "No 'pixel' array" << endl;
@@ -357,6 +369,201 @@ void MyMonitorRequester::unlisten(MonitorPtr const & monitor)
 }
 
 
+#define NS_STRIPE_PENDING 100 /** Number of pulses that may wait for missing stripes */
+
+/** Reassembles pulses from the 'stripeN' channels by pulse ID
+ *
+ *  Stripes arrive via separate channels in any order.
+ *  Once all stripes of a pulse have been received,
+ *  they are combined into the complete time-of-flight and pixel arrays.
+ */
+class StripeAssembler
+{
+    struct Pulse
+    {
+        size_t received;
+        vector<bool> have;
+        vector<vector<uint32> > tof, pixel;
+        Pulse() : received(0) {}
+    };
+
+    size_t stripes;
+    int limit;
+    bool quiet;
+    epicsMutex mutex;
+    map<uint64, Pulse> pending;
+    Event done_event;
+    epicsTime next_run;
+    int assembled;
+    uint64 complete;
+    uint64 incomplete;
+    uint64 duplicates;
+    uint64 events;
+    uint64 last_pulse_id;
+    uint64 missing_pulses;
+    uint64 array_size_differences;
+
+public:
+    StripeAssembler(size_t stripes, int limit, bool quiet)
+    : stripes(stripes), limit(limit), quiet(quiet),
+      next_run(epicsTime::getCurrent()), assembled(0),
+      complete(0), incomplete(0), duplicates(0), events(0), last_pulse_id(0), missing_pulses(0), array_size_differences(0)
+    {}
+
+    /** Add stripe of a pulse. Called by the monitor of each stripe */
+    void add(size_t stripe, uint64 pulse_id,
+             const uint32 *tof, size_t tof_count, const uint32 *pixel, size_t pixel_count);
+
+    boolean waitUntilDone()
+    {
+        return done_event.wait();
+    }
+};
+
+void StripeAssembler::add(size_t stripe, uint64 pulse_id,
+                          const uint32 *tof, size_t tof_count, const uint32 *pixel, size_t pixel_count)
+{
+    // Copy the stripe before locking,
+    // so that the monitors of different stripes copy in parallel
+    vector<uint32> stripe_tof(tof, tof + tof_count);
+    vector<uint32> stripe_pixel(pixel, pixel + pixel_count);
+
+    // Complete pulse, taken out of 'pending'
+    Pulse pulse;
+    {
+        epicsGuard<epicsMutex> guard(mutex);
+        Pulse &entry = pending[pulse_id];
+        if (entry.have.empty())
+        {
+            entry.have.resize(stripes, false);
+            entry.tof.resize(stripes);
+            entry.pixel.resize(stripes);
+        }
+        if (entry.have[stripe])
+        {   // Re-delivered stripe
+            ++duplicates;
+            return;
+        }
+        entry.have[stripe] = true;
+        entry.tof[stripe].swap(stripe_tof);
+        entry.pixel[stripe].swap(stripe_pixel);
+        if (++entry.received < stripes)
+            return;
+
+        pulse.tof.swap(entry.tof);
+        pulse.pixel.swap(entry.pixel);
+        pending.erase(pulse_id);
+
+        size_t tof_events = 0, pixel_events = 0;
+        for (size_t i=0; i<stripes; ++i)
+        {
+            tof_events += pulse.tof[i].size();
+            pixel_events += pulse.pixel[i].size();
+        }
+        ++complete;
+        events += tof_events;
+        if (tof_events != pixel_events)
+            ++array_size_differences;
+        if (last_pulse_id != 0  &&  pulse_id > last_pulse_id + 1)
+            missing_pulses += pulse_id - 1 - last_pulse_id;
+        if (pulse_id > last_pulse_id)
+            last_pulse_id = pulse_id;
+
+        // Drop pulses that are unlikely to ever complete
+        while (! pending.empty()  &&  pending.begin()->first + NS_STRIPE_PENDING < pulse_id)
+        {
+            pending.erase(pending.begin());
+            ++incomplete;
+        }
+
+        if (quiet)
+        {
+            epicsTime now(epicsTime::getCurrent());
+            if (now >= next_run)
+            {
+                cout << complete << " pulses from " << stripes << " stripes, "
+                     << events << " events, "
+                     << incomplete << " incomplete, "
+                     << duplicates << " duplicate stripes, "
+                     << missing_pulses << " missing pulses, "
+                     << array_size_differences << " array size differences"
+                     << endl;
+                complete = incomplete = duplicates = events = missing_pulses = array_size_differences = 0;
+                next_run = now + 10.0;
+            }
+        }
+
+        if (limit > 0  &&  ++assembled >= limit)
+        {
+            cout << "Assembled " << assembled << " pulses" << endl;
+            done_event.signal();
+        }
+    }
+
+    // Combine stripes in order, outside of the lock
+    vector<uint32> all_tof, all_pixel;
+    for (size_t i=0; i<stripes; ++i)
+    {
+        all_tof.insert(all_tof.end(), pulse.tof[i].begin(), pulse.tof[i].end());
+        all_pixel.insert(all_pixel.end(), pulse.pixel[i].begin(), pulse.pixel[i].end());
+    }
+    if (! quiet)
+        cout << "Pulse " << pulse_id << ": " << all_tof.size() << " events from " << stripes << " stripes" << endl;
+}
+
+/** @return Name of stripe channel */
+static string getStripeName(string const &name, size_t stripe)
+{
+    ostringstream buf;
+    buf << name << ":stripe" << stripe;
+    return buf.str();
+}
+
+/** Requester for monitoring one stripe */
+class StripeMonitorRequester : public virtual MyRequester, public virtual MonitorRequester
+{
+    size_t stripe;
+    StripeAssembler &assembler;
+public:
+    StripeMonitorRequester(size_t stripe, StripeAssembler &assembler)
+    : MyRequester("StripeMonitorRequester"), stripe(stripe), assembler(assembler)
+    {}
+
+    void monitorConnect(Status const & status, MonitorPtr const & monitor, StructureConstPtr const & structure)
+    {
+        cout << "Stripe " << stripe << " monitor connects, " << status << endl;
+        if (status.isSuccess())
+            monitor->start();
+    }
+
+    void monitorEvent(MonitorPtr const & monitor);
+
+    void unlisten(MonitorPtr const & monitor)
+    {
+        cout << "Stripe " << stripe << " monitor unlistens" << endl;
+    }
+};
+
+void StripeMonitorRequester::monitorEvent(MonitorPtr const & monitor)
+{
+    shared_ptr<MonitorElement> update;
+    while ((update = monitor->poll()))
+    {
+        shared_ptr<PVInt> user_tag = update->pvStructurePtr->getSubField<PVInt>("timeStamp.userTag");
+        shared_ptr<PVUIntArray> tof = update->pvStructurePtr->getSubField<PVUIntArray>("time_of_flight.value");
+        shared_ptr<PVUIntArray> pixel = update->pvStructurePtr->getSubField<PVUIntArray>("pixel.value");
+        if (user_tag  &&  tof  &&  pixel)
+        {
+            PVUIntArray::const_svector tof_data = tof->view(), pixel_data = pixel->view();
+            assembler.add(stripe, static_cast<uint64>(user_tag->get()),
+                          tof_data.data(), tof_data.size(), pixel_data.data(), pixel_data.size());
+        }
+        else
+            cout << "Stripe " << stripe << " lacks 'timeStamp.userTag', 'time_of_flight' or 'pixel'" << endl;
+        monitor->release(update);
+    }
+}
+
 /** Connect, get value, disconnect */
 void getValue(string const &name, string const &request, double timeout)
 {
@@ -413,6 +620,203 @@ void doMonitor(string const &name, string const &request, double timeout, short
     channel->destroy();
 }
 
+/** Monitor all stripes of a pulse and reassemble them */
+void doStripedMonitor(string const &name, size_t stripes, string const &request, double timeout, short priority, int limit, bool quiet)
+{
+    ChannelProvider::shared_pointer channelProvider =
+            ChannelProviderRegistry::clients()->getProvider("pva");
+    if (! channelProvider)
+        THROW_EXCEPTION2(runtime_error, "No channel provider");
+
+    StripeAssembler assembler(stripes, limit, quiet);
+    shared_ptr<PVStructure> pvRequest = CreateRequest::create()->createRequest(request);
+
+    vector<shared_ptr<MyChannelRequester> > channelRequesters;
+    vector<shared_ptr<Channel> > channels;
+    vector<shared_ptr<StripeMonitorRequester> > monitorRequesters;
+    vector<shared_ptr<Monitor> > monitors;
+    for (size_t i=0; i<stripes; ++i)
+    {
+        channelRequesters.push_back(shared_ptr<MyChannelRequester>(new MyChannelRequester()));
+        channels.push_back(channelProvider->createChannel(getStripeName(name, i), channelRequesters[i], priority));
+    }
+    for (size_t i=0; i<stripes; ++i)
+    {
+        channelRequesters[i]->waitUntilConnected(timeout);
+        monitorRequesters.push_back(shared_ptr<StripeMonitorRequester>(new StripeMonitorRequester(i, assembler)));
+        monitors.push_back(channels[i]->createMonitor(monitorRequesters[i], pvRequest));
+    }
+
+    // Wait until limit or forever..
+    assembler.waitUntilDone();
+
+    for (size_t i=0; i<stripes; ++i)
+    {
+        monitors[i]->stop();
+        monitors[i]->destroy();
+        channels[i]->destroy();
+    }
+}
+
+/** Fetch pulses start..end from the server's pulse history */
+void getHistory(string const &name, uint64 start, uint64 end, double timeout)
+{
+    pvac::ClientProvider provider("pva");
+    pvac::ClientChannel channel(provider.connect(name));
+
+    // NTURI arguments as used by pvcall
+    PVStructurePtr args = getPVDataCreate()->createPVStructure(
+        getFieldCreate()->createFieldBuilder()
+        ->setId("epics:nt/NTURI:1.0")
+        ->add("scheme", pvString)
+        ->add("path", pvString)
+        ->addNestedStructure("query")
+            ->add("start", pvULong)
+            ->add("end", pvULong)
+        ->endNested()
+        ->createStructure());
+    args->getSubField<PVString>("scheme")->put("pva");
+    args->getSubField<PVString>("path")->put(name);
+    args->getSubField<PVULong>("query.start")->put(start);
+    args->getSubField<PVULong>("query.end")->put(end);
+
+    PVStructure::const_shared_pointer reply = channel.rpc(timeout, args);
+
+    cout << "History holds pulses " << reply->getSubFieldT<PVULong>("first_id")->get()
+         << " .. " << reply->getSubFieldT<PVULong>("last_id")->get() << endl;
+    PVStructureArray::const_svector pulses = reply->getSubFieldT<PVStructureArray>("pulses")->view();
+    cout << "Received " << pulses.size() << " of " << (end - start + 1) << " requested pulses" << endl;
+    for (size_t i=0; i<pulses.size(); ++i)
+        cout << "Pulse " << pulses[i]->getSubFieldT<PVULong>("id")->get()
+             << ": " << pulses[i]->getSubFieldT<PVUIntArray>("time_of_flight")->getLength()
+             << " events" << endl;
+}
+
+/** Receive pulses sent via UDP */
+void receiveUDP(string const &address, int limit, bool quiet)
+{
+    using namespace epics::neutronServer;
+    osiSockAddr addr;
+    if (! parseUDPAddress(address, addr))
+        return;
+    SOCKET sock = createUDPReceiver(addr);
+    if (sock == INVALID_SOCKET)
+        return;
+
+    UDPReassembler reassembler;
+    vector<char> buffer(NS_UDP_MAX_DATAGRAM);
+    epicsTime next_run(epicsTime::getCurrent());
+    uint64 events = 0;
+    int pulses = 0;
+    while (limit <= 0  ||  pulses < limit)
+    {
+        ssize_t size = recv(sock, &buffer[0], buffer.size(), 0);
+        if (size < 0)
+        {
+            cout << "UDP receive error" << endl;
+            break;
+        }
+        if (reassembler.add(&buffer[0], size))
+        {
+            ++pulses;
+            events += reassembler.getTOF().size();
+            if (! quiet)
+                cout << "Pulse " << reassembler.getPulseID() << ": "
+                     << reassembler.getTOF().size() << " events, charge "
+                     << reassembler.getCharge() << endl;
+        }
+        if (quiet)
+        {
+            epicsTime now(epicsTime::getCurrent());
+            if (now >= next_run)
+            {
+                cout << reassembler.getComplete() << " pulses, "
+                     << events << " events, "
+                     << reassembler.getIncomplete() << " incomplete, "
+                     << reassembler.getDatagrams() << " datagrams, "
+                     << reassembler.getLost() << " lost, "
+                     << reassembler.getReordered() << " reordered, "
+                     << reassembler.getInvalid() << " invalid"
+                     << endl;
+                reassembler.clearStats();
+                events = 0;
+                next_run = now + 10.0;
+            }
+        }
+    }
+    cout << "Received " << pulses << " pulses, "
+         << reassembler.getLost() << " datagrams lost, "
+         << reassembler.getReordered() << " reordered" << endl;
+    epicsSocketDestroy(sock);
+}
+
+/** Read pulses from shared memory ring, processing the events in place */
+void readSharedMemory(string const &name, int limit, bool quiet)
+{
+    using namespace epics::neutronServer;
+    ShmRingReader ring;
+    if (! ring.open(name))
+        return;
+
+    epicsTime next_run(epicsTime::getCurrent());
+    uint64 last_pulse_id = 0, missing_pulses = 0, invalid = 0, events = 0, updates = 0;
+    int pulses = 0;
+    while (limit <= 0  ||  pulses < limit)
+    {
+        const ShmSlotHeader *slot;
+        const uint32 *tof, *pixel;
+        size_t count;
+        if (! ring.next(slot, tof, pixel, count))
+        {
+            epicsThreadSleep(0.0005);
+            continue;
+        }
+        uint64 pulse_id = slot->pulse_id;
+        double charge = slot->charge;
+        // Process events in place
+        uint64 tof_sum = 0, bank1 = 0;
+        for (size_t i=0; i<count; ++i)
+        {
+            tof_sum += tof[i];
+            if (pixel[i] < 2048)
+                ++bank1;
+        }
+        if (! ring.isValid())
+        {   // Writer overwrote the slot while we read it
+            ++invalid;
+            continue;
+        }
+        ++pulses;
+        ++updates;
+        events += count;
+        if (last_pulse_id != 0  &&  pulse_id > last_pulse_id + 1)
+            missing_pulses += pulse_id - 1 - last_pulse_id;
+        last_pulse_id = pulse_id;
+
+        if (quiet)
+        {
+            epicsTime now(epicsTime::getCurrent());
+            if (now >= next_run)
+            {
+                cout << updates << " pulses, "
+                     << events << " events, "
+                     << missing_pulses << " missing pulses, "
+                     << ring.getOverruns() << " overruns, "
+                     << invalid << " overwritten while reading"
+                     << endl;
+                updates = events = missing_pulses = invalid = 0;
+                ring.clearOverruns();
+                next_run = now + 10.0;
+            }
+        }
+        else
+            cout << "Pulse " << pulse_id << ": " << count << " events, charge " << charge
+                 << ", mean TOF " << (count > 0 ? tof_sum / count : 0)
+                 << ", " << bank1 << " in bank 1" << endl;
+    }
+    cout << "Read " << pulses << " pulses" << endl;
+}
+
 #ifdef USE_PVXS
 void checkUpdate(pvxs::Value &update, bool quiet)
 {
@@ -532,6 +936,35 @@ void doMonitorPvxs(string const &name, string const &request, double timeout, sh
     done.wait();
 
 }
+void doStripedMonitorPvxs(string const &name, size_t stripes, string const &request, double timeout, short priority, int limit, bool quiet)
+{
+    auto ctxt = pvxs::client::Config::from_env().build();
+    StripeAssembler assembler(stripes, limit, quiet);
+    std::vector<std::shared_ptr<pvxs::client::Subscription>> subscriptions;
+    for (size_t i=0; i<stripes; ++i)
+        subscriptions.push_back(ctxt.monitor(getStripeName(name, i))
+                      .pvRequest(request)
+                      .event([&assembler, i](pvxs::client::Subscription& mon)
+        {
+            try {
+                while(auto update = mon.pop()) {
+                    auto tof = update["time_of_flight.value"].as<pvxs::shared_array<const uint32_t>>();
+                    auto pixel = update["pixel.value"].as<pvxs::shared_array<const uint32_t>>();
+                    assembler.add(i, static_cast<uint64>(update["timeStamp.userTag"].as<int32_t>()),
+                                  tof.data(), tof.size(), pixel.data(), pixel.size());
+                }
+            } catch (pvxs::client::Finished& conn) {
+            } catch (pvxs::client::Connected& conn) {
+                std::cerr << " Stripe " << i << " connected to " << conn.peerName << std::endl;
+            } catch (pvxs::client::Disconnect& conn) {
+                std::cerr << " Stripe " << i << " disconnected" << std::endl;
+            } catch (std::exception& err) {
+                std::cerr << " Stripe " << i << " error " << typeid(err).name() << " : " << err.what() << std::endl;
+            }
+        }).exec());
+
+    assembler.waitUntilDone();
+}
 void getValuePvxs(string const &name, string const &request, double timeout)
 {
     auto ctxt = pvxs::client::Config::from_env().build();
@@ -540,6 +973,19 @@ void getValuePvxs(string const &name, string const &request, double timeout)
     // No error checking done here to mimic getValue() as closely as possibly
     // (and show how much shorter the code can be with pvxs)
 }
+void getHistoryPvxs(string const &name, uint64 start, uint64 end, double timeout)
+{
+    auto ctxt = pvxs::client::Config::from_env().build();
+    auto reply = ctxt.rpc(name).arg("start", start).arg("end", end).exec()->wait(timeout);
+    cout << "History holds pulses " << reply["first_id"].as<uint64_t>()
+         << " .. " << reply["last_id"].as<uint64_t>() << endl;
+    auto pulses = reply["pulses"].as<pvxs::shared_array<const pvxs::Value>>();
+    cout << "Received " << pulses.size() << " of " << (end - start + 1) << " requested pulses" << endl;
+    for (auto& pulse: pulses)
+        cout << "Pulse " << pulse["id"].as<uint64_t>()
+             << ": " << pulse["time_of_flight"].as<pvxs::shared_array<const uint32_t>>().size()
+             << " events" << endl;
+}
 #endif
 
 
@@ -553,6 +999,10 @@ static void help(const char *name)
     cout << "  -w seconds : Wait timeout" << endl;
     cout << "  -p priority: Priority, 0..99, default 0" << endl;
     cout << "  -l monitors: Limit runtime to given number of monitors, then quit" << endl;
+    cout << "  -k stripes : Monitor '<channel>:stripe0..N-1' and reassemble pulses" << endl;
+    cout << "  -u address : Receive pulses via UDP from multicast 'group:port' or unicast 'host:port', instead of pvAccess" << endl;
+    cout << "  -M name    : Read pulses from shared memory ring of server on this host, for example '/neutrons'" << endl;
+    cout << "  -g start:end: Get pulses start..end from the '<channel>:history' of the server" << endl;
 }
 
 int main(int argc,char *argv[])
@@ -564,9 +1014,14 @@ int main(int argc,char *argv[])
     bool quiet = false;
     short priority = ChannelProvider::PRIORITY_DEFAULT;
     int limit = 0;
+    bool history = false;
+    uint64 history_start = 0, history_end = 0;
+    size_t stripes = 0;
+    string udp;
+    string shm;
 
     int opt;
-    while ((opt = getopt(argc, argv, "r:w:p:l:mqh")) != -1)
+    while ((opt = getopt(argc, argv, "r:w:p:l:g:k:u:M:mqh")) != -1)
     {
         switch (opt)
         {
@@ -582,6 +1037,30 @@ int main(int argc,char *argv[])
         case 'l':
         	limit = atoi(optarg);
             break;
+        case 'g':
+        {
+            history = true;
+            char *end;
+            history_start = history_end = strtoull(optarg, &end, 0);
+            if (*end == ':')
+                history_end = strtoull(end+1, 0, 0);
+            if (history_end < history_start)
+            {
+                cout << "History end " << history_end << " is before start " << history_start << endl;
+                help(argv[0]);
+                return -1;
+            }
+            break;
+        }
+        case 'u':
+            udp = optarg;
+            break;
+        case 'M':
+            shm = optarg;
+            break;
+        case 'k':
+            stripes = (size_t)atol(optarg);
+            break;
         case 'm':
             monitor = true;
             break;
@@ -607,14 +1086,32 @@ int main(int argc,char *argv[])
 
     try
     {
+        if (! udp.empty())
+        {
+            receiveUDP(udp, limit, quiet);
+            return 0;
+        }
+        if (! shm.empty())
+        {
+            readSharedMemory(shm, limit, quiet);
+            return 0;
+        }
 #ifdef USE_PVXS
-        if (monitor)
+        if (history)
+            getHistoryPvxs(channel + ":history", history_start, history_end, timeout);
+        else if (stripes > 0)
+            doStripedMonitorPvxs(channel, stripes, request, timeout, priority, limit, quiet);
+        else if (monitor)
             doMonitorPvxs(channel, request, timeout, priority, limit, quiet);
         else
             getValuePvxs(channel, request, timeout);
 #else
         ClientFactory::start();
-        if (monitor)
+        if (history)
+            getHistory(channel + ":history", history_start, history_end, timeout);
+        else if (stripes > 0)
+            doStripedMonitor(channel, stripes, request, timeout, priority, limit, quiet);
+        else if (monitor)
             doMonitor(channel, request, timeout, priority, limit, quiet);
         else
             getValue(channel, request, timeout);
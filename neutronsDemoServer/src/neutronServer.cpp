@@ -9,10 +9,21 @@
  * @author Kay Kasemir
  */
 #include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <map>
+#ifdef __linux__
+#   include <pthread.h>
+#   include <sched.h>
+#   include <unistd.h>
+#endif
 #include <epicsTime.h>
+#include <epicsGuard.h>
 #include <workerRunnable.h>
 #include "neutronServer.h"
+#include "peakGenerator.h"
+#include "loadProfile.h"
+#include "bulkFill.h"
 #include "nanoTimer.h"
 
 #ifdef USE_PVXS
@@ -30,105 +41,6 @@
 
 namespace epics { namespace neutronServer {
 
-
-#ifdef USE_PVXS
-    // Nothing to do here
-#else
-// And the actual implementation of NeutronPVRecord
-
-NeutronPVRecord::shared_pointer NeutronPVRecord::create(string const & recordName)
-{
-    FieldCreatePtr fieldCreate = getFieldCreate();
-    StandardFieldPtr standardField = getStandardField();
-    PVDataCreatePtr pvDataCreate = getPVDataCreate();
-
-    // Create the data structure that the PVRecord should use
-    PVStructurePtr pvStructure = pvDataCreate->createPVStructure(
-        fieldCreate->createFieldBuilder()
-        ->add("timeStamp", standardField->timeStamp())
-        // Demo for manual setup of structure, could use
-        // add("proton_charge", standardField->scalar(pvDouble, ""))
-        ->addNestedStructure("proton_charge")
-            ->setId("epics:nt/NTScalar:1.0")
-            ->add("value", pvDouble)
-        ->endNested()
-        ->add("time_of_flight", standardField->scalarArray(pvUInt, ""))
-        ->add("pixel", standardField->scalarArray(pvUInt, ""))
-        ->createStructure()
-        );
-
-    NeutronPVRecord::shared_pointer pvRecord(new NeutronPVRecord(recordName, pvStructure));
-    if (!pvRecord->init())
-        pvRecord.reset();
-    return pvRecord;
-}
-
-NeutronPVRecord::NeutronPVRecord(string const & recordName, PVStructurePtr const & pvStructure)
-: PVRecord(recordName,pvStructure), pulse_id(0)
-{
-}
-
-bool NeutronPVRecord::init()
-{
-    initPVRecord();
-
-    // Fetch pointers into the records pvData which will be used to update the values
-    if (!pvTimeStamp.attach(getPVStructure()->getSubField("timeStamp")))
-        return false;
-
-    pvProtonCharge = getPVStructure()->getSubField<PVDouble>("proton_charge.value");
-    if (pvProtonCharge.get() == NULL)
-        return false;
-
-    pvTimeOfFlight = getPVStructure()->getSubField<PVUIntArray>("time_of_flight.value");
-    if (pvTimeOfFlight.get() == NULL)
-        return false;
-
-    pvPixel = getPVStructure()->getSubField<PVUIntArray>("pixel.value");
-    if (pvPixel.get() == NULL)
-        return false;
-
-    return true;
-}
-
-void NeutronPVRecord::process()
-{
-    // Update timestamp
-    timeStamp.getCurrent();
-    // pulse_id is unsigned, put into userTag as signed?
-    timeStamp.setUserTag(static_cast<int>(pulse_id));
-    pvTimeStamp.set(timeStamp);
-}
-
-void NeutronPVRecord::update(uint64 id, double charge,
-                             shared_vector<const uint32> tof,
-                             shared_vector<const uint32> pixel)
-{
-    lock();
-    try
-    {
-        beginGroupPut();
-        pulse_id = id;
-        pvProtonCharge->put(charge);
-        pvTimeOfFlight->replace(tof);
-        pvPixel->replace(pixel);
-
-        // TODO Create server-side overrun by updating same field
-        // multiple times within one 'group put'
-        // pvPulseID->put(id);
-
-        process();
-        endGroupPut();
-    }
-    catch(...)
-    {
-        unlock();
-        throw;
-    }
-    unlock();
-}
-#endif // USE_PVXS
-
 // --------------------------------------------------------------------------------------------
 // What follows is the FakeNeutronEventRunnable that creates dummy data.
 // Basic profiling by periodically pausing the code in the debugger showed that
@@ -140,95 +52,265 @@ void NeutronPVRecord::update(uint64 id, double charge,
 // then posting updated data as both provide a result.
 // --------------------------------------------------------------------------------------------
 
+/** Pin calling thread to one CPU, or allow all CPUs for cpu < 0 */
+static void pinThread(int cpu)
+{
+#ifdef __linux__
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus <= 0)
+        return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (cpu < 0)
+        for (long i=0; i<cpus; ++i)
+            CPU_SET(i, &set);
+    else
+        CPU_SET(cpu % cpus, &set);
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (error)
+        std::cout << "Cannot pin thread to CPU " << cpu << ": " << strerror(error) << std::endl;
+#endif
+}
+
 /** Runnable that creates an array.
  *  When creating a large demo data arrays,
  *  the two arrays can be filled in separate threads / CPU cores
  */
+#ifdef USE_PVXS
+typedef pvxs::shared_array<uint32_t> WideArray;
+typedef pvxs::shared_array<uint16_t> NarrowArray;
+#else
+typedef shared_vector<uint32> WideArray;
+typedef shared_vector<uint16> NarrowArray;
+#endif
+
+/** Parameters of an ArrayRunnable request */
+struct ArrayRequest
+{
+    /** How many events */
+    size_t count;
+    /** Used to create dummy events */
+    uint32_t id;
+    /** Generate semi-real looking data? */
+    bool realistic;
+    /** Optional generator for events in peaks */
+    const PeakGenerator *peaks;
+    /** Generate narrow elements? */
+    bool narrow;
+    /** Provide uint32 events also for narrow elements? */
+    bool need_wide;
+    /** CPU for the worker thread, -1 for all CPUs */
+    int cpu;
+
+    ArrayRequest()
+    : count(0), id(0), realistic(false), peaks(0), narrow(false), need_wide(true), cpu(-1)
+    {}
+};
+
+/** Result of an ArrayRunnable request */
+struct ArrayResult
+{
+    /** uint32 events, empty if narrow and not needed */
+    EventArray events;
+    /** Events for the record, narrow or the same as 'events' */
+    PublishedEvents posted;
+};
+
 class ArrayRunnable : public WorkerRunnable
 {
 public:
     ArrayRunnable()
-    : count(0), id(0), realistic(0)
+    : wide_scale(1), pinned_cpu(-1)
     {}
 
-    /** Start collecting events (fill array with simulated data) */
-    void createEvents(size_t count, uint64_t id, bool realistic)
+    // Settings are called by the thread that creates requests
+    // and apply to the following requests
+
+    /** Generate uint16 instead of uint32 elements
+     *  @param need_wide Also provide the events as uint32 EventArray, for consumers
+     */
+    void setNarrow(bool narrow, bool need_wide)
+    {
+        settings.narrow = narrow;
+        settings.need_wide = need_wide;
+    }
+
+    /** Use peak generator instead of flat or realistic data */
+    void setPeakGenerator(const PeakGenerator *peaks)
     {
-        this->count = count;
-        this->id = id;
-        this->realistic = realistic;
-        startWork();
+        settings.peaks = peaks;
     }
 
-    /** Wait for data to be filled and return it */
+    /** Pin worker thread to CPU, -1 for all CPUs */
+    void setCPU(int cpu)
+    {
+        settings.cpu = cpu;
+    }
+
+    /** Request events (fill array with simulated data)
+     *
+     *  Each request keeps its own copy of the parameters and settings.
+     *  Blocks while the maximum number of requests is outstanding,
+     *  see setMaxOutstanding().
+     *
+     *  @param count How many events
+     *  @param id Used to create dummy events
+     *  @param realistic Generate semi-real looking data
+     *  @return Handle for the events
+     */
+    WorkHandle<ArrayResult> createEvents(size_t count, uint64_t id, bool realistic)
+    {
+        ArrayRequest request = settings;
+        request.count = count;
+        request.id = static_cast<uint32_t>(id);
+        request.realistic = realistic;
+        return submit<ArrayResult>([this, request](ArrayResult &result)
+        {
+            pin(request.cpu);
+            fill(request, result);
+        });
+    }
+
+protected:
+    /** Called by worker thread to fill 'result' for a request */
+    virtual void fill(const ArrayRequest &request, ArrayResult &result) = 0;
+
+    /** Factor from narrow elements to the uint32 events */
+    uint32_t wide_scale;
+
+private:
+    /** Settings for the next request */
+    ArrayRequest settings;
+    /** Current CPU of the worker thread */
+    int pinned_cpu;
+
+    /** Called by worker thread to apply a changed CPU */
+    void pin(int cpu)
+    {
+        if (cpu == pinned_cpu)
+            return;
+        pinThread(cpu);
+        pinned_cpu = cpu;
+    }
+
+protected:
+
+    /** @return Events that share the memory of a frozen array */
+    template <typename Array>
+    static PublishedEvents share(const Array &array, bool narrow)
+    {
+        return PublishedEvents(std::shared_ptr<const void>(array.dataPtr(), array.data()), array.size(), narrow);
+    }
+
+    /** Freeze generated array into the result */
+    void setResult(WideArray &array, ArrayResult &result)
+    {
 #ifdef USE_PVXS
-    shared_array<const uint32_t> getEvents()
+        result.events = array.freeze();
 #else
-    shared_vector<const uint32> getEvents()
+        result.events = freeze(array);
 #endif
-    {
-        waitForCompletion();
-        return data;
+        result.posted = share(result.events, false);
     }
 
-protected:
-    /** Parameters for new data request: How many events */
-    size_t count;
-    /** Parameters for new data request: Used to create dummy events */
-    uint32_t id;
-    /** Flag to generate semi-real looking data.**/
-    bool realistic;
-    /** Result of a request for data */
+    /** Freeze generated array into the result,
+     *  widening it in this thread if consumers need the uint32 events
+     */
+    void setResult(NarrowArray &array, bool need_wide, ArrayResult &result)
+    {
+        if (need_wide)
+        {
+            WideArray wide(array.size());
+            if (wide_scale == 1)
+                std::copy(array.begin(), array.end(), wide.begin());
+            else
+                for (size_t i=0; i<array.size(); ++i)
+                    wide[i] = array[i] * wide_scale;
+#ifdef USE_PVXS
+            result.events = wide.freeze();
+#else
+            result.events = freeze(wide);
+#endif
+        }
+        else
+            result.events = EventArray();
 #ifdef USE_PVXS
-    pvxs::shared_array<const uint32_t> data;
+        result.posted = share(array.freeze(), true);
 #else
-    shared_vector<const uint32> data;
+        result.posted = share(freeze(array), true);
 #endif
+    }
 };
 
+/** @return Normally distributed time-of-flight */
+static inline uint32_t realisticTOF()
+{
+    uint32_t normal_tof = 0;
+    for (uint32_t j = 0; j < NS_TOF_NORM; ++j)
+        normal_tof += rand() % (NS_TOF_MAX);
+    return int(normal_tof/NS_TOF_NORM);
+}
+
+/** @return Pixel ID in two detector banks, alternating by event index */
+static inline uint32_t realisticPixel(size_t i)
+{
+    //Generate random number between NS_ID_MIN1 and NS_ID_MAX1, or between NS_ID_MIN2 and NS_ID_MAX2
+    if (i%2 == 0)
+        return (rand() % (NS_ID_MAX1-NS_ID_MIN1)) + NS_ID_MIN1;
+    else
+        return (rand() % (NS_ID_MAX2-NS_ID_MIN2)) + NS_ID_MIN2;
+}
+
 
 
 class TimeOfFlightRunnable : public ArrayRunnable
 {
+public:
+    TimeOfFlightRunnable()
+    {   // Consumers receive unscaled time-of-flight
+        wide_scale = NS_NARROW_TOF_SCALE;
+    }
+
 protected:
-    void doWork();
+    void fill(const ArrayRequest &request, ArrayResult &result);
 };
 
-void TimeOfFlightRunnable::doWork()
+void TimeOfFlightRunnable::fill(const ArrayRequest &request, ArrayResult &result)
 {
-    // Compare PVXS vs PVAccess as two blocks since code is short
-#ifdef USE_PVXS
-    pvxs::shared_array<uint32_t> tof(count);
-    if (this->realistic == false)
-        std::fill(tof.begin(), tof.end(), id);
-    else
-    {
-        for (size_t i = 0; i < count; i++)
+    const size_t count = request.count;
+    const uint32_t id = request.id;
+    const PeakGenerator *peaks = request.peaks;
+    if (request.narrow)
+    {   // Scaled to 16 bits, generated directly into the posted array
+        NarrowArray tof(count);
+        if (peaks)
+            peaks->generateTOF(id, tof.data(), count, NS_NARROW_TOF_SCALE);
+        else if (request.realistic == false)
+            std::fill(tof.begin(), tof.end(), static_cast<uint16_t>(id));
+        else
         {
-            uint32_t normal_tof = 0;
-            for (uint32_t j = 0; j < NS_TOF_NORM; ++j)
-                normal_tof += rand() % (NS_TOF_MAX);
-            tof[i] = int(normal_tof/NS_TOF_NORM);
+            for (size_t i = 0; i < count; i++)
+                tof[i] = static_cast<uint16_t>(realisticTOF() / NS_NARROW_TOF_SCALE);
         }
+        setResult(tof, request.need_wide, result);
+        return;
     }
-    data = tof.freeze();
-#else
-    shared_vector<uint32> tof(count);
-    if (this->realistic == false)
-        fill(tof.begin(), tof.end(), id);
+
+    WideArray tof(count);
+    // Arrays larger than the cache are written with streaming stores
+    if (peaks)
+        peaks->generateTOF(id, tof.data(), count);
+    else if (request.realistic == false)
+        fillEvents(tof.data(), id, count);
     else
     {
-        uint32 *p = tof.dataPtr().get();
-        for (uint32 i = 0; i != tof.size(); ++i)
+        generateEvents(tof.data(), count, [](uint32_t *block, size_t, size_t n)
         {
-            uint32 normal_tof = 0;
-            for (uint j = 0; j < NS_TOF_NORM; ++j)
-                normal_tof += rand() % (NS_TOF_MAX);
-            *(p++) = int(normal_tof/NS_TOF_NORM);
-        }
+            for (size_t i = 0; i < n; i++)
+                block[i] = realisticTOF();
+        });
     }
-    data = freeze(tof);
-#endif
+    setResult(tof, result);
 }
 
 class PixelRunnable : public ArrayRunnable
@@ -236,11 +318,15 @@ class PixelRunnable : public ArrayRunnable
 public:
     NanoTimer timer;
 protected:
-    void doWork();
+    void fill(const ArrayRequest &request, ArrayResult &result);
 };
 
-void PixelRunnable::doWork()
+void PixelRunnable::fill(const ArrayRequest &request, ArrayResult &result)
 {
+    const size_t count = request.count;
+    const uint32_t id = request.id;
+    const PeakGenerator *peaks = request.peaks;
+
     // Compare PVXS vs PVAccess in individual blocks this time
 
 	// In reality, each event would have a different value,
@@ -248,14 +334,34 @@ void PixelRunnable::doWork()
     // each element.
     uint32_t value = id * 10;
 
+    if (request.narrow)
+    {   // Pixel IDs of realistic and peak data fit 16 bits
+        timer.start();
+        NarrowArray pixel(count);
+        if (peaks)
+            peaks->generatePixels(id, pixel.data(), count);
+        else if (request.realistic == false)
+            std::fill(pixel.begin(), pixel.end(), static_cast<uint16_t>(value));
+        else
+        {
+            for (size_t i=0; i<count; ++i)
+                pixel[i] = static_cast<uint16_t>(realisticPixel(i));
+        }
+        timer.stop();
+        setResult(pixel, request.need_wide, result);
+        return;
+    }
+
     // Pixels created in this thread
-#ifdef USE_PVXS
-    pvxs::shared_array<uint32_t> pixel(count);
-#else
-    shared_vector<uint32> pixel(count);
-#endif
+    WideArray pixel(count);
 
-    if (this->realistic == false)
+    if (peaks)
+    {
+        timer.start();
+        peaks->generatePixels(id, pixel.data(), count);
+        timer.stop();
+    }
+    else if (request.realistic == false)
     {
         // Set elements via [] operator of shared_vector
         // This takes about 1.5 ms for 200000 elements
@@ -275,115 +381,200 @@ void PixelRunnable::doWork()
         // Speed almost as good as std::fill(), about 0.65 ms,
         // and we could conceivably put different values into
         // each array element.
+        // timer.start();
+        // uint32 *p = pixel.dataPtr().get();
+        // for (size_t i=0; i<count; ++i)
+        //     *(p++) = value;
+        // timer.stop();
+
+        // Same for arrays that fit into the cache,
+        // streaming stores for larger arrays to keep the cache for
+        // the record update and serialization.
+        // See bulkFillBench
         timer.start();
-#ifdef USE_PVXS
-        for (size_t i=0; i<count; ++i)
-            pixel[i] = value;
-#else
-        uint32 *p = pixel.dataPtr().get();
-        for (size_t i=0; i<count; ++i)
-            *(p++) = value;
-#endif
+        fillEvents(pixel.data(), value, count);
         timer.stop();
-    
     }
     else
     {
         //Pixel IDs in two detector banks.
-        //Generate random number between NS_ID_MIN1 and NS_ID_MAX1, or between NS_ID_MIN2 and NS_ID_MAX2
         timer.start();
-#ifdef USE_PVXS
-        for (size_t i=0; i<count; ++i)
-        {
-            if (i%2 == 0)
-                pixel[i] = (rand() % (NS_ID_MAX1-NS_ID_MIN1)) + NS_ID_MIN1;
-            else
-                pixel[i] = (rand() % (NS_ID_MAX2-NS_ID_MIN2)) + NS_ID_MIN2;
-        }
-#else
-        uint32 *p = pixel.dataPtr().get();
-        for (uint32 i = 0; i != pixel.size(); ++i)
+        generateEvents(pixel.data(), count, [](uint32_t *block, size_t offset, size_t n)
         {
-            if (i%2 == 0)
-                *(p++) = (rand() % (NS_ID_MAX1-NS_ID_MIN1)) + NS_ID_MIN1;
-            else
-                *(p++) = (rand() % (NS_ID_MAX2-NS_ID_MIN2)) + NS_ID_MIN2;
-        }
-#endif
+            for (size_t i=0; i<n; ++i)
+                block[i] = realisticPixel(offset+i);
+        });
         timer.stop();
     }
 
-#ifdef USE_PVXS
-    data = pixel.freeze();
-#else
-    data = freeze(pixel);
-#endif
+    setResult(pixel, result);
+}
+
+/** Show post latency statistics for a phase of the load profile */
+static void reportLatency(const LoadProfile &profile, size_t phase, const LatencyStats &latency)
+{
+    if (latency.getCount() <= 0)
+        return;
+    std::cout << "Phase " << phase << " (" << profile.getPhase(phase).toString() << "): "
+              << latency.getCount() << " pulses, post latency p50 "
+              << latency.getPercentile(50) / 1000 << " us, p99 "
+              << latency.getPercentile(99) / 1000 << " us, max "
+              << latency.getMax() / 1000 << " us" << std::endl;
 }
 
 FakeNeutronEventRunnable::FakeNeutronEventRunnable(const std::string& record_name,
                                                    double delay, size_t event_count, bool random_count,
                                                    bool realistic, size_t skip_packets)
-  : is_running(true), delay(delay), event_count(event_count), random_count(random_count),
-    realistic(realistic), skip_packets(skip_packets)
-#ifdef USE_PVXS
-  , record(pvxs::server::SharedPV::buildReadonly())
-#endif
+  : record_name(record_name), is_running(true), delay(delay), event_count(event_count), transport_only(false),
+    narrow_pixel(false), narrow_tof(false)
 {
+  settings.random_count = random_count;
+  settings.realistic = realistic;
+  settings.skip_packets = skip_packets;
+}
+
+std::shared_ptr<RecordPublisher> FakeNeutronEventRunnable::getRecordPublisher()
+{   // Created on first use, so a runnable with its own publisher has no record
+    if (! record)
+    {
 #ifdef USE_PVXS
-  recordDef = Neutrons{}.build();
-  Value initial = recordDef.create();
-  record.open(initial);
+        record.reset(new PVXSPublisher(narrow_pixel, narrow_tof));
 #else
-  record = NeutronPVRecord::create(record_name);
+        record.reset(new PVDatabasePublisher(record_name, narrow_pixel, narrow_tof));
 #endif
+    }
+    return record;
 }
 
 void FakeNeutronEventRunnable::run()
 {
+    if (! publisher)
+        publisher = getRecordPublisher();
     std::shared_ptr<ArrayRunnable> tof_runnable(new TimeOfFlightRunnable());
     std::shared_ptr<epicsThread> tof_thread(new epicsThread(*tof_runnable, "tof_processor", epicsThreadGetStackSize(epicsThreadStackMedium)));
     tof_thread->start();
 
     std::shared_ptr<PixelRunnable> pixel_runnable(new PixelRunnable());
+    // Narrow arrays are only widened when consumers need them
+    tof_runnable->setNarrow(narrow_tof, ! consumers.empty());
+    pixel_runnable->setNarrow(narrow_pixel, ! consumers.empty());
     std::shared_ptr<epicsThread> pixel_thread(new epicsThread(*pixel_runnable, "pixel_processor", epicsThreadGetStackSize(epicsThreadStackMedium)));
     pixel_thread->start();
 
     //uint64_t id = 0;
     id = 0;
-    size_t packets = 0, slow = 0;
+    size_t packets = 0, slow = 0, total_slow = 0;
 
     epicsTime last_run(epicsTime::getCurrent());
     epicsTime next_log(last_run);
     epicsTime next_run;
 
+    // Load profile: Time since start, active phase, post latency within that phase
+    epicsTime profile_start(last_run);
+    size_t phase = 0;
+    LatencyStats latency;
+
+    // Transport-only payloads, shared by all pulses with that event count
+    struct Payload
+    {
+        ArrayResult tof, pixel;
+    };
+    std::map<size_t, Payload> payloads;
+
+    // Time to fill and post the record update
+    NanoTimer post_timer;
+
+    // Settings of the current pulse
+    GeneratorSettings active = getSettings();
+    int pinned_cpu = -1;
+    tof_runnable->setPeakGenerator(active.use_peaks ? peaks.get() : 0);
+    pixel_runnable->setPeakGenerator(active.use_peaks ? peaks.get() : 0);
+
+    if (transport_only)
+    {   // Prepare payload for the default count at startup
+        WorkHandle<ArrayResult> tof = tof_runnable->createEvents(event_count, 1, active.realistic);
+        WorkHandle<ArrayResult> pixel = pixel_runnable->createEvents(event_count, 1, active.realistic);
+        try
+        {
+            Payload payload;
+            payload.tof = tof.get();
+            payload.pixel = pixel.get();
+            payloads[event_count] = payload;
+        }
+        catch (std::exception &ex)
+        {   // Loop will try again
+            std::cout << "Cannot create payload of " << event_count << " events: " << ex.what() << std::endl;
+        }
+    }
+
     while (is_running)
     { 
+        // Apply changed settings at the pulse boundary,
+        // while the array threads are idle
+        active = getSettings();
+        if (active.use_peaks  &&  ! peaks)
+        {
+            std::shared_ptr<PeakGenerator> demo(new PeakGenerator());
+            demo->createDemo();
+            peaks = demo;
+        }
+        tof_runnable->setPeakGenerator(active.use_peaks ? peaks.get() : 0);
+        pixel_runnable->setPeakGenerator(active.use_peaks ? peaks.get() : 0);
+        if (active.cpu != pinned_cpu)
+        {
+            pinThread(active.cpu);
+            pinned_cpu = active.cpu;
+        }
+        tof_runnable->setCPU(active.cpu < 0 ? -1 : active.cpu + 1);
+        pixel_runnable->setCPU(active.cpu < 0 ? -1 : active.cpu + 2);
+
         // Compute time for next run
-        next_run = last_run + delay;
+        next_run = last_run + delay * active.batch;
 
         // Wait until then
         double sleep = next_run - epicsTime::getCurrent();
         if (sleep >= 0)
             epicsThreadSleep(sleep);
         else
+        {
             ++slow;
+            ++total_slow;
+        }
 
-        // Increment the 'ID' of the pulse
-        ++id;
+        // Increment the 'ID' of the pulse, a batch uses the ID of its last pulse
+        id += active.batch;
 
-        // Optionally skip every Nth packet
+        // Optionally skip every Nth packet, or the batch that contains it
         bool skip = false;
-        if (skip_packets > 0) {
-          skip = ((id % skip_packets) == 0);
+        if (active.skip_packets > 0) {
+          skip = (id / active.skip_packets) != ((id - active.batch) / active.skip_packets);
         }
 
         if (!skip) {
 
           // Create fake { time-of-flight, pixel } events,
           // using the ID to get changing values, in parallel threads
-          size_t count = random_count ? (rand() % event_count) : event_count;
-          tof_runnable->createEvents(count, id, realistic);
-          pixel_runnable->createEvents(count, id, realistic);
+          size_t count = active.random_count ? (rand() % event_count) : event_count;
+          count *= active.batch;
+          if (profile)
+          {
+              size_t active;
+              count = static_cast<size_t>(count * profile->getScale(epicsTime::getCurrent() - profile_start, active) + 0.5);
+              if (active != phase)
+              {
+                  reportLatency(*profile, phase, latency);
+                  latency.clear();
+                  phase = active;
+              }
+          }
+          WorkHandle<ArrayResult> tof_request, pixel_request;
+          if (! transport_only)
+          {
+              // With one thread, pixels are requested once time-of-flight is done
+              tof_request = tof_runnable->createEvents(count, id, active.realistic);
+              if (active.threads > 1)
+                  pixel_request = pixel_runnable->createEvents(count, id, active.realistic);
+          }
           
           // >>>> While array threads are running >>>>
           // Mark this run
@@ -396,7 +587,9 @@ void FakeNeutronEventRunnable::run()
               next_log = last_run + 10.0;
               std::cout << packets << " packets, " << slow << " times slow";
               std::cout << ", array values set in " << pixel_runnable->timer;
+              std::cout << ", posted in " << post_timer;
               std::cout << std::endl;
+              publisher->report();
               slow = 0;
             }
 
@@ -404,20 +597,69 @@ void FakeNeutronEventRunnable::run()
           double charge = (1 + id % 10)*1e8;
 
           // <<<< Wait for array threads, fetch their data <<<<
-#ifdef USE_PVXS
-          // This replaces 90 lines of code for NeutronPVRecord implementation at the top of the file
-          Value update = recordDef.create();
-          epicsTimeStamp now = epicsTime::getCurrent();
-          update["timeStamp.secondsPastEpoch"] = now.secPastEpoch;
-          update["timeStamp.nanoseconds"] = now.nsec;
-          update["timeStamp.userTag"] = id;
-          update["proton_charge.value"] = charge;
-          update["time_of_flight.value"] = tof_runnable->getEvents();
-          update["pixel.value"] = pixel_runnable->getEvents();
-          record.post(std::move(update));
-#else
-          record->update(id, charge, tof_runnable->getEvents(), pixel_runnable->getEvents());
-#endif
+          EventArray tof_data, pixel_data;
+          PublishedEvents posted_tof, posted_pixel;
+          try
+          {
+              if (transport_only)
+              {
+                  std::map<size_t, Payload>::iterator payload = payloads.find(count);
+                  if (payload == payloads.end())
+                  {   // New event count, for example from -m or load profile.
+                      // Bound memory usage by dropping all older payloads
+                      if (payloads.size() >= NS_TRANSPORT_PAYLOADS)
+                          payloads.clear();
+                      WorkHandle<ArrayResult> tof = tof_runnable->createEvents(count, 1, active.realistic);
+                      WorkHandle<ArrayResult> pixel = pixel_runnable->createEvents(count, 1, active.realistic);
+                      Payload created;
+                      created.tof = tof.get();
+                      created.pixel = pixel.get();
+                      payload = payloads.insert(std::make_pair(count, created)).first;
+                  }
+                  tof_data = payload->second.tof.events;
+                  pixel_data = payload->second.pixel.events;
+                  posted_tof = payload->second.tof.posted;
+                  posted_pixel = payload->second.pixel.posted;
+              }
+              else
+              {
+                  tof_data = tof_request.get().events;
+                  posted_tof = tof_request.get().posted;
+                  if (active.threads <= 1)
+                      pixel_request = pixel_runnable->createEvents(count, id, active.realistic);
+                  pixel_data = pixel_request.get().events;
+                  posted_pixel = pixel_request.get().posted;
+              }
+          }
+          catch (std::exception &ex)
+          {   // For example out of memory for a large count: Skip this pulse
+              std::cout << "Pulse " << id << ": Cannot create " << count << " events: " << ex.what() << std::endl;
+              continue;
+          }
+          post_timer.start();
+          publisher->publish(id, charge, posted_tof, posted_pixel);
+          post_timer.stop();
+          {
+              epicsGuard<epicsMutex> guard(statistics_mutex);
+              statistics.packets = packets;
+              statistics.slow = total_slow;
+              statistics.events = count;
+              statistics.fill_ns = pixel_runnable->timer.getTotalNanosecs();
+              statistics.fill_runs = pixel_runnable->timer.getRuns();
+              statistics.post_ns = post_timer.getTotalNanosecs();
+              statistics.post_runs = post_timer.getRuns();
+          }
+          // Latency from scheduled pulse time until posted,
+          // includes delays when the previous pulse took too long
+          if (profile)
+          {
+              double secs = epicsTime::getCurrent() - next_run;
+              latency.add(secs > 0 ? static_cast<uint64_t>(secs * 1e9) : 0);
+          }
+
+          // Frozen arrays are shared, not copied, by consumers
+          for (size_t i=0; i<consumers.size(); ++i)
+              consumers[i]->addPulse(id, charge, tof_data, pixel_data);
 
           // TODO Overflow the server queue by posting several updates.
           // For client request "record[queueSize=2]field()", this causes overrun.
@@ -428,8 +670,12 @@ void FakeNeutronEventRunnable::run()
 
     }
 
+    if (profile)
+        reportLatency(*profile, phase, latency);
     pixel_runnable->shutdown();
     tof_runnable->shutdown();
+    for (size_t i=0; i<consumers.size(); ++i)
+        consumers[i]->shutdown();
     std::cout << "Processing thread exits\n";
     processing_done.signal();
 }
@@ -451,8 +697,113 @@ void FakeNeutronEventRunnable::setID(size_t id_)
 }
 
 void FakeNeutronEventRunnable::setRandomCount(bool random_count)
-{   // No locking..
-	this->random_count = random_count;
+{
+    epicsGuard<epicsMutex> guard(settings_mutex);
+    settings.random_count = random_count;
+}
+
+void FakeNeutronEventRunnable::setPeakGenerator(std::shared_ptr<const PeakGenerator> peaks)
+{   // Call before starting the thread
+    this->peaks = peaks;
+    epicsGuard<epicsMutex> guard(settings_mutex);
+    settings.use_peaks = peaks.get() != 0;
+}
+
+void FakeNeutronEventRunnable::setRealistic(bool realistic)
+{
+    epicsGuard<epicsMutex> guard(settings_mutex);
+    settings.realistic = realistic;
+}
+
+void FakeNeutronEventRunnable::setPeaks(bool use_peaks)
+{
+    epicsGuard<epicsMutex> guard(settings_mutex);
+    settings.use_peaks = use_peaks;
+}
+
+void FakeNeutronEventRunnable::setSkipPackets(size_t skip_packets)
+{
+    epicsGuard<epicsMutex> guard(settings_mutex);
+    settings.skip_packets = skip_packets;
+}
+
+void FakeNeutronEventRunnable::setThreads(size_t threads)
+{
+    epicsGuard<epicsMutex> guard(settings_mutex);
+    settings.threads = threads > 1 ? 2 : 1;
+}
+
+void FakeNeutronEventRunnable::setBatch(size_t batch)
+{
+    epicsGuard<epicsMutex> guard(settings_mutex);
+    settings.batch = batch > 0 ? batch : 1;
+}
+
+void FakeNeutronEventRunnable::setCPU(int cpu)
+{
+    epicsGuard<epicsMutex> guard(settings_mutex);
+    settings.cpu = cpu < 0 ? -1 : cpu;
+}
+
+GeneratorSettings FakeNeutronEventRunnable::getSettings()
+{
+    epicsGuard<epicsMutex> guard(settings_mutex);
+    return settings;
+}
+
+void FakeNeutronEventRunnable::addConsumer(std::shared_ptr<PulseConsumer> consumer)
+{   // Call before starting the thread
+    consumers.push_back(consumer);
+}
+
+void FakeNeutronEventRunnable::setLoadProfile(std::shared_ptr<const LoadProfile> profile)
+{   // Call before starting the thread
+    this->profile = profile;
+}
+
+void FakeNeutronEventRunnable::setTransportOnly(bool transport_only)
+{   // Call before starting the thread
+    this->transport_only = transport_only;
+}
+
+void FakeNeutronEventRunnable::setNarrow(bool narrow_pixel, bool narrow_tof)
+{   // Call before getRecord() and starting the thread
+    this->narrow_pixel = narrow_pixel;
+    this->narrow_tof = narrow_tof;
+}
+
+void FakeNeutronEventRunnable::setPublisher(std::shared_ptr<EventPublisher> publisher)
+{   // Call before starting the thread
+    this->publisher = publisher;
+}
+
+NeutronStatistics FakeNeutronEventRunnable::getStatistics()
+{
+    epicsGuard<epicsMutex> guard(statistics_mutex);
+    return statistics;
+}
+
+void FakeNeutronEventRunnable::report(int level)
+{
+    NeutronStatistics stats = getStatistics();
+    std::cout << record_name << ": " << stats.packets << " packets, " << stats.slow << " times slow, "
+              << stats.events << " events in last pulse";
+    if (stats.fill_runs > 0)
+        std::cout << ", array values set in " << stats.fill_ns / stats.fill_runs / 1000.0 << " us";
+    if (stats.post_runs > 0)
+        std::cout << ", posted in " << stats.post_ns / stats.post_runs / 1000.0 << " us";
+    std::cout << std::endl;
+    if (level > 0)
+    {
+        GeneratorSettings active = getSettings();
+        std::cout << "  delay " << delay << " s, count " << event_count
+                  << (active.random_count ? " (random)" : "")
+                  << ", " << (active.use_peaks ? "peaks" : active.realistic ? "realistic" : "flat")
+                  << ", skip " << active.skip_packets
+                  << ", threads " << active.threads
+                  << ", batch " << active.batch
+                  << ", cpu " << active.cpu << std::endl;
+    }
 }
 
 void FakeNeutronEventRunnable::shutdown()
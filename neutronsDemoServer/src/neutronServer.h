@@ -11,23 +11,23 @@
 #ifndef NEUTRONSERVER_H
 #define NEUTRONSERVER_H
 
+#include <memory>
+#include <vector>
 #include <shareLib.h>
 #include <epicsEvent.h>
+#include <epicsMutex.h>
 #include <epicsThread.h>
+#include "nanoTimer.h"
+#include "eventPublisher.h"
 
 #ifdef USE_PVXS
-#    include <pvxs/data.h>
-#    include <pvxs/server.h>
-#    include <pvxs/sharedpv.h>
+#    include "pvxsPublisher.h"
 #else
-#    include <pv/pvDatabase.h>
-#    include <pv/timeStamp.h>
-#    include <pv/pvTimeStamp.h>
+#    include "pvDatabasePublisher.h"
 #endif
 
 namespace epics { namespace neutronServer {
 
-#define NS_TOF_MAX 160000 /** Maximum TOF value for the -r option (realistic data)*/
 #define NS_TOF_NORM 10 /** Number of random samples for each TOF to generate a normal distribution*/
 
 #define NS_ID_MIN1 0    /** Min pixel ID for detector 1 */
@@ -35,92 +35,85 @@ namespace epics { namespace neutronServer {
 #define NS_ID_MIN2 2048 /** Min pixel ID for detector 2 */
 #define NS_ID_MAX2 3072 /** Max pixel ID for detector 2 */
 
-/** Record that serves this type of pvData:
- *
- *  structure
- *      // Time stamp for everything in this structure,
- *      // userTag is sequential number to check for missed
- *      // updates
- *      time_t  timeStamp
- *      NTScalar proton_charge
- *          double  value
- *      NTScalarArray time_of_flight
- *          uint[]  value
- *      NTScalarArray pixel
- *          uint[]  value
- */
-#ifdef USE_PVXS
-struct Neutrons {
-    // We don't have to define Neutrons structure here,
-    // but we do it for completness and comparison with NeutronPVRecord
+#define NS_TRANSPORT_PAYLOADS 100 /** Max. number of payload sizes kept in transport-only mode */
 
-    //! A TypeDef which can be appended
-    PVXS_API
-    pvxs::TypeDef build() const
-    {
-        using namespace pvxs;
-        using namespace pvxs::members;
-
-        TypeDef def(
-            TypeCode::Struct,
-            {
-                Struct("timeStamp", "time_t", {
-                    Int64("secondsPastEpoch"),
-                    Int32("nanoseconds"),
-                    Int32("userTag"),
-                }),
-                Struct("time_of_flight", "epics:nt/NTScalarArray:1.0", {
-                    UInt32A("value")
-                }),
-                Struct("pixel", "epics:nt/NTScalarArray:1.0", {
-                    UInt32A("value")
-                }),
-                Struct("proton_charge", "epics:nt/NTScalar:1.0", {
-                    Float64("value")
-                }),
-            }
-        );
-
-        return def;
-    }
-    //! Instanciate
-    inline pvxs::Value create() const {
-        return build().create();
-    }
-};
+#define NS_DETECTOR_WIDTH  64 /** Pixels per detector row, pixel ID = x + y * width */
+#define NS_DETECTOR_HEIGHT 64 /** Detector rows, covers NS_ID_MAX2 */
 
-#else // !defined(USE_PVXS)
+/** Array of events, frozen so that it can be shared by the record and other consumers */
+#ifdef USE_PVXS
+typedef pvxs::shared_array<const uint32_t> EventArray;
+#else
+typedef epics::pvData::shared_vector<const epics::pvData::uint32> EventArray;
+#endif
+
+class PeakGenerator;
+class LoadProfile;
 
-class NeutronPVRecord : public epics::pvDatabase::PVRecord
+/** Consumer of generated pulses
+ *
+ *  Called by the event generator thread after each pulse has been posted.
+ *  The arrays are frozen, so they are shared, not copied.
+ */
+class PulseConsumer
 {
 public:
-    POINTER_DEFINITIONS(NeutronPVRecord);
+    virtual ~PulseConsumer() {}
 
-    // PVRecord methods
-    static NeutronPVRecord::shared_pointer create(std::string const & recordName);
-    virtual bool init();
-    virtual void process();
+    /** Handle a pulse */
+    virtual void addPulse(uint64_t id, double charge, EventArray tof, EventArray pixel) = 0;
 
-    /** Update the values of the record */
-    void update(epics::pvData::uint64 id, double charge,
-                epics::pvData::shared_vector<const epics::pvData::uint32> tof,
-                epics::pvData::shared_vector<const epics::pvData::uint32> pixel);
+    /** Stop threads. Called when the generator exits */
+    virtual void shutdown() = 0;
+};
 
-private:
-    NeutronPVRecord(std::string const & recordName,
-                    epics::pvData::PVStructurePtr const & pvStructure);
-
-    // Time of last process() call
-    epics::pvData::TimeStamp      timeStamp;
-    epics::pvData::uint32         pulse_id;
-
-    // Pointers in to the records' data structure
-    epics::pvData::PVTimeStamp    pvTimeStamp;
-    epics::pvData::PVDoublePtr    pvProtonCharge;
-    epics::pvData::PVUIntArrayPtr pvTimeOfFlight;
-    epics::pvData::PVUIntArrayPtr pvPixel;
+/** Publisher for the record of this build's backend */
+#ifdef USE_PVXS
+typedef PVXSPublisher RecordPublisher;
+#else
+typedef PVDatabasePublisher RecordPublisher;
+#endif
+
+/** Generator statistics since start, see FakeNeutronEventRunnable::getStatistics() */
+struct NeutronStatistics
+{
+    /** Published pulses */
+    uint64_t packets;
+    /** Pulses that started late because the previous one took too long */
+    uint64_t slow;
+    /** Events in the last pulse */
+    uint64_t events;
+    /** Total time and number of runs for setting the array values */
+    uint64_t fill_ns, fill_runs;
+    /** Total time and number of runs for posting */
+    uint64_t post_ns, post_runs;
+
+    NeutronStatistics()
+    : packets(0), slow(0), events(0), fill_ns(0), fill_runs(0), post_ns(0), post_runs(0)
+    {}
+};
+
+/** Generator settings that may change while running.
+ *  Applied at the start of the next pulse.
+ */
+struct GeneratorSettings
+{
+    bool random_count;
+    bool realistic;
+    /** Generate events in Bragg peaks */
+    bool use_peaks;
+    size_t skip_packets;
+    /** Threads that fill the arrays: 2 fill time-of-flight and pixels in parallel, 1 one after the other */
+    size_t threads;
+    /** Pulses published as one update */
+    size_t batch;
+    /** Pin generator and array threads to CPUs cpu, cpu+1, cpu+2, or -1 to not pin them */
+    int cpu;
+
+    GeneratorSettings()
+    : random_count(false), realistic(false), use_peaks(false), skip_packets(0), threads(2), batch(1), cpu(-1)
+    {}
 };
-#endif // USE_PVXS
 
 /** Runnable for demo events */
 class FakeNeutronEventRunnable : public epicsThreadRunable
@@ -133,33 +126,89 @@ public:
     void setCount(size_t count);
     void setID(size_t id);
     void setRandomCount(bool random_count);
+    /** Generate events in Bragg peaks instead of flat or 'realistic' data.
+     *  Call before starting the thread
+     */
+    void setPeakGenerator(std::shared_ptr<const PeakGenerator> peaks);
+    /** Use 'realistic' data. Applied at the next pulse */
+    void setRealistic(bool realistic);
+    /** Use the peak generator, creating demo peaks if none was set.
+     *  Applied at the next pulse
+     */
+    void setPeaks(bool use_peaks);
+    /** Skip every Nth pulse, 0 to publish all. Applied at the next pulse */
+    void setSkipPackets(size_t skip_packets);
+    /** Fill arrays in parallel (2) or one after the other (1). Applied at the next pulse */
+    void setThreads(size_t threads);
+    /** Publish 'batch' pulses as one update with 'batch' times the events,
+     *  at 'batch' times the delay. Applied at the next pulse
+     */
+    void setBatch(size_t batch);
+    /** Pin threads to CPUs starting at 'cpu', -1 to allow all CPUs. Applied at the next pulse */
+    void setCPU(int cpu);
+    /** @return Current settings */
+    GeneratorSettings getSettings();
+    /** Add consumer for each pulse. Call before starting the thread */
+    void addConsumer(std::shared_ptr<PulseConsumer> consumer);
+    /** Scale event count over time by beam power profile,
+     *  reporting post latency for each phase.
+     *  Call before starting the thread
+     */
+    void setLoadProfile(std::shared_ptr<const LoadProfile> profile);
+    /** Transport-only benchmark: Generate one payload per event count,
+     *  then re-post the same frozen arrays with only the time stamp,
+     *  pulse ID and charge changing.
+     *  Call before starting the thread
+     */
+    void setTransportOnly(bool transport_only);
+    /** Use uint16 elements for the pixel and/or time-of-flight arrays of the record.
+     *  Pixel IDs must be below 65536, which holds for realistic and peak data.
+     *  Consumers still receive uint32 arrays.
+     *  Call before getRecord() and before starting the thread
+     */
+    void setNarrow(bool narrow_pixel, bool narrow_tof);
+    /** Publish via this publisher instead of the record,
+     *  which is then not created unless getRecord() is called.
+     *  Call before starting the thread
+     */
+    void setPublisher(std::shared_ptr<EventPublisher> publisher);
     void shutdown();
+    /** @return Snapshot of the statistics, may be called from any thread */
+    NeutronStatistics getStatistics();
+    /** Show statistics, and settings for level > 0 */
+    void report(int level);
 #ifdef USE_PVXS
     pvxs::server::SharedPV& getRecord()
     {
-        return record;
+        return getRecordPublisher()->getRecord();
     }
 #else
     NeutronPVRecord::shared_pointer getRecord()
     {
-        return record;
+        return getRecordPublisher()->getRecord();
     }
 #endif
 private:
-#ifdef USE_PVXS
-    pvxs::server::SharedPV record;
-    pvxs::TypeDef recordDef;
-#else
-    NeutronPVRecord::shared_pointer record;
-#endif
+    /** @return Publisher of the record, created on first call */
+    std::shared_ptr<RecordPublisher> getRecordPublisher();
+
+    std::string record_name;
+    std::shared_ptr<RecordPublisher> record;
+    std::shared_ptr<EventPublisher> publisher;
     bool is_running;
     epicsEvent processing_done;
     double delay;
     size_t event_count;
-    bool random_count;
-    bool realistic;
-    size_t skip_packets;
+    epicsMutex settings_mutex;
+    GeneratorSettings settings;
     uint64_t id;
+    std::shared_ptr<const PeakGenerator> peaks;
+    std::vector<std::shared_ptr<PulseConsumer> > consumers;
+    std::shared_ptr<const LoadProfile> profile;
+    bool transport_only;
+    bool narrow_pixel, narrow_tof;
+    epicsMutex statistics_mutex;
+    NeutronStatistics statistics;
 };
 
 }}
@@ -20,6 +20,17 @@
 #include <epicsThread.h>
 
 #include "neutronServer.h"
+#include "detectorImage.h"
+#include "tofConversion.h"
+#include "eventFilter.h"
+#include "pulseDecimation.h"
+#include "pulseHistory.h"
+#include "peakGenerator.h"
+#include "loadProfile.h"
+#include "stripedPublisher.h"
+#include "udpPublisher.h"
+#include "shmPublisher.h"
+#include "eventRecorder.h"
 
 using namespace epics::neutronServer;
 using namespace std;
@@ -42,7 +53,21 @@ static void help(const char *name)
     cout << "  -e count  : Max event count per packet (default 10)" << endl;
     cout << "  -m : Random event count, using 'count' as maximum" << endl;
     cout << "  -r : Generate normally distributed data which looks semi realistic." << endl;
+    cout << "  -p file   : Generate events in Bragg peaks listed in file, 'demo' for built-in peaks" << endl;
+    cout << "  -P profile: Beam power profile, 'ramp 10 0 1; steady 20 1; trip 2; burst 10 1 0.1 1 0.2; repeat' or @file" << endl;
+    cout << "  -N arrays : Narrow uint16 record arrays 'pixel', 'tof' (scaled by " << NS_NARROW_TOF_SCALE << ") or 'all', requires -r or -p" << endl;
+    cout << "  -T : Transport only: Re-post the same frozen arrays for each pulse, bypassing event generation" << endl;
+    cout << "  -S stripes: Also publish each pulse split into 'neutrons:stripe0..N-1' (default 0 which means disabled)" << endl;
+    cout << "  -U address: Also send pulses as UDP datagrams to multicast 'group:port' or 'host:port'" << endl;
+    cout << "  -M name   : Also write pulses to shared memory ring for clients on this host, for example '/neutrons'" << endl;
+    cout << "  -R file   : Record all pulses to file, with index in file.idx" << endl;
+    cout << "  -I seconds: .. show recorder statistics at this period (default 0, only on exit)" << endl;
     cout << "  -s Nth : Don't send every N'th packet to simulate losing data packets (default 0 which means disabled)." << endl;
+    cout << "  -i seconds: Publish detector image 'neutrons:image' at this period (default 0 which means disabled)" << endl;
+    cout << "  -a decay  : Image decay factor 0..1 applied on each image update, 0 to reset (default 1, accumulate)" << endl;
+    cout << "  -c file   : Publish 'neutrons:wavelength' using per-pixel calibration file, 'demo' for built-in calibration" << endl;
+    cout << "  -D        : .. publish 'neutrons:d_spacing' instead of wavelength" << endl;
+    cout << "  -H pulses : Keep history of this many pulses, fetch via RPC 'neutrons:history' (default 0 which means disabled)" << endl;
 }
 
 int main(int argc,char *argv[])
@@ -52,9 +77,23 @@ int main(int argc,char *argv[])
     bool random_count = false;
     bool realistic = false;
     size_t skip_packets = 0;
+    double image_period = 0.0;
+    double image_decay = 1.0;
+    string calibration_file;
+    TOFCalibration::Kind conversion = TOFCalibration::WAVELENGTH;
+    size_t history_pulses = 0;
+    string peak_file;
+    string load_profile;
+    bool transport_only = false;
+    string narrow;
+    size_t stripe_count = 0;
+    string udp_address;
+    string shm_name;
+    string record_file;
+    double record_report = 0.0;
 
     int opt;
-    while ((opt = getopt(argc, argv, "d:e:h:mrs:")) != -1)
+    while ((opt = getopt(argc, argv, "d:e:h:mrs:i:a:c:DH:p:P:N:TS:U:M:R:I:")) != -1)
     {
         switch (opt)
         {
@@ -76,6 +115,48 @@ int main(int argc,char *argv[])
         case 's':
                 skip_packets = (size_t)atol(optarg);
                 break;
+        case 'i':
+            image_period = atof(optarg);
+            break;
+        case 'a':
+            image_decay = atof(optarg);
+            break;
+        case 'c':
+            calibration_file = optarg;
+            break;
+        case 'D':
+            conversion = TOFCalibration::D_SPACING;
+            break;
+        case 'H':
+            history_pulses = (size_t)atol(optarg);
+            break;
+        case 'p':
+            peak_file = optarg;
+            break;
+        case 'P':
+            load_profile = optarg;
+            break;
+        case 'N':
+            narrow = optarg;
+            break;
+        case 'T':
+            transport_only = true;
+            break;
+        case 'S':
+            stripe_count = (size_t)atol(optarg);
+            break;
+        case 'U':
+            udp_address = optarg;
+            break;
+        case 'M':
+            shm_name = optarg;
+            break;
+        case 'R':
+            record_file = optarg;
+            break;
+        case 'I':
+            record_report = atof(optarg);
+            break;
         default:
             help(argv[0]);
             return -1;
@@ -85,21 +166,151 @@ int main(int argc,char *argv[])
     cout << "Delay : " << delay << " seconds" << endl;
     cout << "Events: " << event_count << endl;
     cout << "Realistic: " << realistic << endl;
+    if (transport_only) {
+      cout << "Transport only, re-posting the same arrays" << endl;
+    }
     if (skip_packets > 0) {
       cout << "Skipping every " << skip_packets << " packets." << endl;
     }
+    if (image_period > 0) {
+      cout << "Image : every " << image_period << " seconds, decay " << image_decay << endl;
+    }
 
     std::shared_ptr<FakeNeutronEventRunnable> runnable(new FakeNeutronEventRunnable("neutrons", delay, event_count, random_count, realistic, skip_packets));
+    runnable->setTransportOnly(transport_only);
+
+    if (! narrow.empty())
+    {
+        bool narrow_pixel = narrow == "pixel"  ||  narrow == "all";
+        bool narrow_tof = narrow == "tof"  ||  narrow == "all";
+        if (! (narrow_pixel || narrow_tof))
+        {
+            cout << "Invalid -N '" << narrow << "', expected 'pixel', 'tof' or 'all'" << endl;
+            return -1;
+        }
+        // Flat data uses the pulse ID, which would overflow 16 bits
+        if (! realistic  &&  peak_file.empty())
+        {
+            cout << "Narrow arrays require -r or -p" << endl;
+            return -1;
+        }
+        cout << "Narrow: " << (narrow_pixel ? "pixel " : "") << (narrow_tof ? "tof" : "") << endl;
+        runnable->setNarrow(narrow_pixel, narrow_tof);
+    }
     auto neutrons(runnable->getRecord());
 
+    if (! peak_file.empty())
+    {
+        std::shared_ptr<PeakGenerator> peaks(new PeakGenerator());
+        if (peak_file == "demo")
+            peaks->createDemo();
+        else if (! peaks->load(peak_file))
+            return -1;
+        cout << "Peaks : " << peaks->getPeakCount() << endl;
+        runnable->setPeakGenerator(peaks);
+    }
+
+    if (! load_profile.empty())
+    {
+        std::shared_ptr<LoadProfile> profile(new LoadProfile());
+        if (load_profile[0] == '@')
+        {
+            if (! profile->load(load_profile.substr(1)))
+                return -1;
+        }
+        else if (! profile->parse(load_profile))
+            return -1;
+        cout << "Load profile:" << endl;
+        for (size_t i=0; i<profile->getPhaseCount(); ++i)
+            cout << "  " << i << ": " << profile->getPhase(i).toString() << endl;
+        runnable->setLoadProfile(profile);
+    }
+
+    std::shared_ptr<DetectorImage> image;
+    if (image_period > 0)
+    {
+        image.reset(new DetectorImage("neutrons:image", NS_IMAGE_WIDTH, NS_IMAGE_HEIGHT, NS_IMAGE_SECTIONS,
+                                      image_period, image_decay));
+        runnable->addConsumer(image);
+    }
+
+    std::shared_ptr<TOFConversion> converter;
+    string converted_name = conversion == TOFCalibration::D_SPACING ? "neutrons:d_spacing" : "neutrons:wavelength";
+    if (! calibration_file.empty())
+    {
+        TOFCalibration calibration;
+        if (calibration_file == "demo")
+            calibration.createDemo(conversion);
+        else if (! calibration.load(calibration_file, conversion))
+            return -1;
+        cout << "Conversion: " << converted_name << " for " << calibration.getFactors().size()-1 << " pixels" << endl;
+        converter.reset(new TOFConversion(converted_name, calibration));
+        runnable->addConsumer(converter);
+    }
+
+    std::shared_ptr<PulseHistory> history;
+    if (history_pulses > 0)
+    {
+        cout << "History: " << history_pulses << " pulses" << endl;
+        history.reset(new PulseHistory(history_pulses, NS_HISTORY_BYTES));
+        runnable->addConsumer(history);
+    }
+
+    std::shared_ptr<StripedPublisher> stripes;
+    if (stripe_count > 0)
+    {
+        cout << "Stripes: " << stripe_count << endl;
+        stripes.reset(new StripedPublisher("neutrons", stripe_count));
+        runnable->addConsumer(stripes);
+    }
+
+    if (! udp_address.empty())
+    {
+        std::shared_ptr<UDPPublisher> udp(new UDPPublisher());
+        if (! udp->init(udp_address))
+            return -1;
+        cout << "UDP: " << udp_address << endl;
+        runnable->addConsumer(udp);
+    }
+
+    if (! shm_name.empty())
+    {   // Slots sized for the max. event count
+        std::shared_ptr<ShmPublisher> shm(new ShmPublisher());
+        if (! shm->init(shm_name, NS_SHM_SLOTS, event_count))
+            return -1;
+        cout << "Shared memory: " << shm_name << endl;
+        runnable->addConsumer(shm);
+    }
+
+    if (! record_file.empty())
+    {
+        std::shared_ptr<EventRecorder> recorder(new EventRecorder());
+        recorder->setReportPeriod(record_report);
+        if (! recorder->init(record_file))
+            return -1;
+        cout << "Recording: " << record_file << endl;
+        runnable->addConsumer(recorder);
+    }
+
 #ifdef USE_PVXS
     // Nothing required for PVXS
 #else
+    registerEventFilterPlugin();
+    registerPulseDecimationPlugins();
     PVDatabasePtr master = PVDatabase::getMaster();
     ChannelProviderLocalPtr channelProvider = getChannelProviderLocal();
 
     if (! master->addRecord(neutrons))
         throw std::runtime_error("Cannot add record " + neutrons->getRecordName());
+    if (image  &&  ! master->addRecord(image->getRecord()))
+        throw std::runtime_error("Cannot add record " + image->getRecord()->getRecordName());
+    if (converter  &&  ! master->addRecord(converter->getRecord()))
+        throw std::runtime_error("Cannot add record " + converted_name);
+    for (size_t i=0; stripes  &&  i<stripes->getStripeCount(); ++i)
+        if (! master->addRecord(stripes->getRecord(i)))
+            throw std::runtime_error("Cannot add record " + stripes->getRecordName(i));
+    if (history  &&  ! master->addRecord(history->createRecord("neutrons:history")))
+        throw std::runtime_error("Cannot add record neutrons:history");
 #endif
 
     shared_ptr<epicsThread> thread(new epicsThread(*runnable, "processor", epicsThreadGetStackSize(epicsThreadStackMedium)));
@@ -107,6 +318,14 @@ int main(int argc,char *argv[])
 
 #ifdef USE_PVXS
     pvxs::server::Server serv = pvxs::server::Config::from_env().build().addPV("neutrons", neutrons);
+    if (image)
+        serv.addPV("neutrons:image", image->getRecord());
+    if (converter)
+        serv.addPV(converted_name, converter->getRecord());
+    if (history)
+        serv.addPV("neutrons:history", history->createPV());
+    for (size_t i=0; stripes  &&  i<stripes->getStripeCount(); ++i)
+        serv.addPV(stripes->getRecordName(i), stripes->getRecord(i));
     serv.start();
 #else
     ServerContext::shared_pointer pvaServer = startPVAServer(PVACCESS_ALL_PROVIDERS,0,true,true);
@@ -14,6 +14,11 @@
 #include <epicsExport.h>
 
 #include <neutronServer.h>
+#include <detectorImage.h>
+#include <eventFilter.h>
+#include <pulseDecimation.h>
+#include <iocServer.h>
+#include <neutronBench.h>
 
 using namespace epics::neutronServer;
 
@@ -23,8 +28,10 @@ static const iocshArg createArg2 = { "eventCount", iocshArgInt };
 static const iocshArg createArg3 = { "randomCount", iocshArgInt };
 static const iocshArg createArg4 = { "realistic", iocshArgInt };
 static const iocshArg createArg5 = { "skipPackets", iocshArgInt };
-static const iocshArg *createArgs[] = { &createArg0, &createArg1, &createArg2, &createArg3, &createArg4, &createArg5 };
-static const iocshFuncDef createFuncDef = { "neutronServerCreateRecord", 6, createArgs};
+static const iocshArg createArg6 = { "imagePeriodSecs", iocshArgDouble };
+static const iocshArg createArg7 = { "imageDecay", iocshArgDouble };
+static const iocshArg *createArgs[] = { &createArg0, &createArg1, &createArg2, &createArg3, &createArg4, &createArg5, &createArg6, &createArg7 };
+static const iocshFuncDef createFuncDef = { "neutronServerCreateRecord", 8, createArgs};
 static void createFunc(const iocshArgBuf *args)
 {
     char *record_name = args[0].sval;
@@ -33,27 +40,49 @@ static void createFunc(const iocshArgBuf *args)
     bool random_count = args[3].ival;
     bool realistic = args[4].ival;
     size_t skip_packets = args[5].ival;
+    double image_period = args[6].dval;
+    double image_decay = args[7].dval;
 
     if (delay > 0)
     {
-        FakeNeutronEventRunnable *runnable = new FakeNeutronEventRunnable(record_name, delay, event_count, random_count, realistic, skip_packets);
-        auto record = runnable->getRecord();
-#ifdef USE_PVXS
-//        pvxs::server::Server serv = server::Config::from_env().build().addPV(record_name, record);
-#else
-        if (! epics::pvDatabase::PVDatabase::getMaster()->addRecord(record))
-            std::cout << "Cannot create neutron record '" << record_name << "'" << std::endl;
-#endif
-        epicsThread *thread = new epicsThread(*runnable, "FakeNeutrons", epicsThreadGetStackSize(epicsThreadStackMedium));
-        thread->start();
+        std::shared_ptr<FakeNeutronEventRunnable> runnable(new FakeNeutronEventRunnable(record_name, delay, event_count, random_count, realistic, skip_packets));
+        iocAddRecord(record_name, runnable->getRecord());
+        if (image_period > 0)
+        {   // Image named "<record>:image"
+            std::string image_name = std::string(record_name) + ":image";
+            std::shared_ptr<DetectorImage> image(new DetectorImage(image_name, NS_IMAGE_WIDTH, NS_IMAGE_HEIGHT, NS_IMAGE_SECTIONS,
+                                                                   image_period, image_decay));
+            iocAddRecord(image_name, image->getRecord());
+            runnable->addConsumer(image);
+        }
+        iocStartRunnable(runnable, "FakeNeutrons");
     }
 }
 
+static const iocshArg benchArg0 = { "seconds", iocshArgDouble };
+static const iocshArg benchArg1 = { "eventCounts", iocshArgString };
+static const iocshArg benchArg2 = { "threads", iocshArgString };
+static const iocshArg *benchArgs[] = { &benchArg0, &benchArg1, &benchArg2 };
+static const iocshFuncDef benchFuncDef = { "neutronBench", 3, benchArgs};
+static void benchFunc(const iocshArgBuf *args)
+{
+    std::string counts = args[1].sval ? args[1].sval : "";
+    std::string threads = args[2].sval ? args[2].sval : "";
+    neutronBench(args[0].dval, counts, threads);
+}
+
 static void neutronServerRegister(void)
 {
     static int times = 0;
     if (++times == 1)
+    {
         iocshRegister(&createFuncDef, createFunc);
+        iocshRegister(&benchFuncDef, benchFunc);
+#ifndef USE_PVXS
+        registerEventFilterPlugin();
+        registerPulseDecimationPlugins();
+#endif
+    }
     else
         std::cout << "neutronServerRegister called " << times << " times" << std::endl;
 }
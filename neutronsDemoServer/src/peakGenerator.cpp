@@ -0,0 +1,230 @@
+/* peakGenerator.cpp
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "neutronServer.h"
+#include "peakGenerator.h"
+
+namespace epics { namespace neutronServer {
+
+/** 'splitmix64' hash, turns counter into random bits */
+static inline uint64_t mix(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/** @return Random bits for an event, same in all threads */
+static inline uint64_t eventKey(uint64_t id, size_t i)
+{
+    return mix((id << 32) ^ i);
+}
+
+/** Different random bits for the pixel and tof of an event */
+#define NS_TOF_SALT   0x5851f42d4c957f2dULL
+#define NS_PIXEL_SALT 0x14057b7ef767814fULL
+
+static inline double clamp(double value, double low, double high)
+{
+    return std::max(low, std::min(value, high));
+}
+
+PeakGenerator::PeakGenerator()
+: background(0.0), normal(NS_NORMAL_TABLE_SIZE)
+{
+    // Invert CDF(z) = erfc(-z/sqrt(2))/2 by bisection, once
+    for (size_t i=0; i<NS_NORMAL_TABLE_SIZE; ++i)
+    {
+        double p = (i + 0.5) / NS_NORMAL_TABLE_SIZE;
+        double low = -10.0, high = 10.0;
+        for (int iter=0; iter<60; ++iter)
+        {
+            double z = (low + high) / 2;
+            if (0.5 * erfc(-z / M_SQRT2) < p)
+                low = z;
+            else
+                high = z;
+        }
+        normal[i] = static_cast<float>((low + high) / 2);
+    }
+    updateCumulative();
+}
+
+bool PeakGenerator::load(const std::string &filename)
+{
+    std::ifstream file(filename.c_str());
+    if (! file)
+    {
+        std::cout << "Cannot open peak file '" << filename << "'" << std::endl;
+        return false;
+    }
+    peaks.clear();
+    background = 0.0;
+    std::string line;
+    size_t line_no = 0;
+    while (std::getline(file, line))
+    {
+        ++line_no;
+        size_t comment = line.find('#');
+        if (comment != std::string::npos)
+            line.erase(comment);
+        std::istringstream items(line);
+        std::string first;
+        if (! (items >> first))
+            continue; // Empty line
+        if (first == "background")
+        {
+            if (! (items >> background)  ||  background < 0)
+            {
+                std::cout << filename << ":" << line_no << ": Expected 'background intensity'" << std::endl;
+                return false;
+            }
+            continue;
+        }
+        Peak peak;
+        peak.pixel = strtoul(first.c_str(), 0, 0);
+        if (! (items >> peak.pixel_sigma >> peak.tof >> peak.tof_sigma >> peak.intensity)  ||  peak.intensity < 0)
+        {
+            std::cout << filename << ":" << line_no << ": Expected 'pixel pixel_sigma tof tof_sigma intensity'" << std::endl;
+            return false;
+        }
+        peaks.push_back(peak);
+    }
+    updateCumulative();
+    if (cumulative.back() == 0)
+    {
+        std::cout << "No peaks nor background in '" << filename << "'" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void PeakGenerator::createDemo()
+{
+    peaks.clear();
+    // Strong, sharp peak and two weaker, broader ones in bank 1, two in bank 2
+    const Peak demo[] =
+    {
+        {  300, 1.5,  40000,  400, 10.0 },
+        {  700, 2.5,  60000,  800,  4.0 },
+        {  900, 3.0, 110000, 1500,  2.0 },
+        { 2300, 2.0,  50000,  600,  6.0 },
+        { 2900, 4.0, 130000, 2000,  3.0 },
+    };
+    for (size_t i=0; i<sizeof(demo)/sizeof(demo[0]); ++i)
+        peaks.push_back(demo[i]);
+    background = 25.0;
+    updateCumulative();
+}
+
+void PeakGenerator::addPeak(const Peak &peak)
+{
+    peaks.push_back(peak);
+    updateCumulative();
+}
+
+void PeakGenerator::setBackground(double intensity)
+{
+    background = intensity;
+    updateCumulative();
+}
+
+void PeakGenerator::updateCumulative()
+{
+    double total = background;
+    for (size_t i=0; i<peaks.size(); ++i)
+        total += peaks[i].intensity;
+
+    cumulative.resize(peaks.size() + 1);
+    double sum = 0;
+    for (size_t i=0; i<peaks.size(); ++i)
+    {
+        sum += peaks[i].intensity;
+        cumulative[i] = total > 0 ? static_cast<uint64_t>(sum / total * 4294967296.0) : 0;
+    }
+    // Background is last, always reached
+    cumulative[peaks.size()] = total > 0 ? 4294967296ULL : 0;
+}
+
+size_t PeakGenerator::selectPeak(uint64_t event_key) const
+{
+    uint64_t u = event_key & 0xFFFFFFFFULL;
+    return std::upper_bound(cumulative.begin(), cumulative.end(), u) - cumulative.begin();
+}
+
+template <typename T>
+void PeakGenerator::fillTOF(uint64_t id, T *tof, size_t count, uint32_t scale) const
+{
+    const size_t mask = NS_NORMAL_TABLE_SIZE - 1;
+    for (size_t i=0; i<count; ++i)
+    {
+        uint64_t key = eventKey(id, i);
+        size_t peak = selectPeak(key);
+        uint64_t bits = mix(key ^ NS_TOF_SALT);
+        if (peak < peaks.size())
+            tof[i] = static_cast<T>(static_cast<uint32_t>(clamp(peaks[peak].tof + peaks[peak].tof_sigma * normal[bits & mask],
+                                                                0.0, NS_TOF_MAX)) / scale);
+        else
+            tof[i] = static_cast<T>(static_cast<uint32_t>(bits % NS_TOF_MAX) / scale);
+    }
+}
+
+template <typename T>
+void PeakGenerator::fillPixels(uint64_t id, T *pixel, size_t count) const
+{
+    const size_t mask = NS_NORMAL_TABLE_SIZE - 1;
+    for (size_t i=0; i<count; ++i)
+    {
+        uint64_t key = eventKey(id, i);
+        size_t peak = selectPeak(key);
+        uint64_t bits = mix(key ^ NS_PIXEL_SALT);
+        if (peak < peaks.size())
+        {   // Spread in detector x and y
+            const Peak &p = peaks[peak];
+            double x = clamp(p.pixel % NS_DETECTOR_WIDTH + p.pixel_sigma * normal[bits & mask],
+                             0.0, NS_DETECTOR_WIDTH - 1);
+            double y = clamp(p.pixel / NS_DETECTOR_WIDTH + p.pixel_sigma * normal[(bits >> 16) & mask],
+                             0.0, NS_DETECTOR_HEIGHT - 1);
+            pixel[i] = static_cast<T>(static_cast<uint32_t>(x + 0.5) + static_cast<uint32_t>(y + 0.5) * NS_DETECTOR_WIDTH);
+        }
+        else if (bits & (1ULL << 63))
+            pixel[i] = static_cast<T>(NS_ID_MIN1 + (bits % (NS_ID_MAX1-NS_ID_MIN1)));
+        else
+            pixel[i] = static_cast<T>(NS_ID_MIN2 + (bits % (NS_ID_MAX2-NS_ID_MIN2)));
+    }
+}
+
+void PeakGenerator::generateTOF(uint64_t id, uint32_t *tof, size_t count) const
+{
+    fillTOF(id, tof, count, 1);
+}
+
+void PeakGenerator::generatePixels(uint64_t id, uint32_t *pixel, size_t count) const
+{
+    fillPixels(id, pixel, count);
+}
+
+void PeakGenerator::generateTOF(uint64_t id, uint16_t *tof, size_t count, uint32_t scale) const
+{
+    fillTOF(id, tof, count, scale);
+}
+
+// Pixel IDs stay within the detector banks, below 4096, so they always fit 16 bits
+void PeakGenerator::generatePixels(uint64_t id, uint16_t *pixel, size_t count) const
+{
+    fillPixels(id, pixel, count);
+}
+
+}} // namespace neutronServer, epics
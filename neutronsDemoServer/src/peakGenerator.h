@@ -0,0 +1,111 @@
+/* peakGenerator.h
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#ifndef PEAKGENERATOR_H
+#define PEAKGENERATOR_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace epics { namespace neutronServer {
+
+#define NS_NORMAL_TABLE_SIZE 4096 /** Entries in inverse normal CDF table, power of 2 */
+
+/** Bragg peak: Events spread around a pixel and time-of-flight */
+struct Peak
+{
+    /** Pixel ID of the peak centre */
+    uint32_t pixel;
+    /** Spread in pixels, applied to both detector x and y */
+    double pixel_sigma;
+    /** Time-of-flight centre and width */
+    double tof, tof_sigma;
+    /** Relative intensity */
+    double intensity;
+};
+
+/** Generates events in Bragg peaks on top of a flat background
+ *
+ *  Each event first selects a peak or the background,
+ *  weighted by intensity, then samples its pixel and time-of-flight.
+ *  All sampling uses precomputed cumulative tables.
+ *
+ *  Time-of-flight and pixel arrays are filled by different threads.
+ *  To keep the two values of each event in the same peak,
+ *  the random numbers are derived from the pulse ID and event index
+ *  instead of a sequential random number generator.
+ */
+class PeakGenerator
+{
+public:
+    PeakGenerator();
+
+    /** Load peaks from file
+     *
+     *  Each line lists "pixel pixel_sigma tof tof_sigma intensity",
+     *  or "background intensity". '#' starts a comment.
+     *
+     *  @return true on success
+     */
+    bool load(const std::string &filename);
+
+    /** Create a few demo peaks in both detector banks */
+    void createDemo();
+
+    void addPeak(const Peak &peak);
+
+    void setBackground(double intensity);
+
+    /** @return Number of peaks */
+    size_t getPeakCount() const
+    {
+        return peaks.size();
+    }
+
+    /** Fill time-of-flight array for a pulse */
+    void generateTOF(uint64_t id, uint32_t *tof, size_t count) const;
+
+    /** Fill pixel array for a pulse */
+    void generatePixels(uint64_t id, uint32_t *pixel, size_t count) const;
+
+    /** Fill narrow time-of-flight array for a pulse
+     *  @param scale Divisor for time-of-flight values
+     */
+    void generateTOF(uint64_t id, uint16_t *tof, size_t count, uint32_t scale) const;
+
+    /** Fill narrow pixel array for a pulse */
+    void generatePixels(uint64_t id, uint16_t *pixel, size_t count) const;
+
+private:
+    template <typename T>
+    void fillTOF(uint64_t id, T *tof, size_t count, uint32_t scale) const;
+
+    template <typename T>
+    void fillPixels(uint64_t id, T *pixel, size_t count) const;
+
+    /** Update cumulative peak intensity table */
+    void updateCumulative();
+
+    /** @return Index of peak for event, peaks.size() for background */
+    size_t selectPeak(uint64_t event_key) const;
+
+    std::vector<Peak> peaks;
+    double background;
+
+    /** Cumulative intensity of peaks and background, scaled to 2^32 */
+    std::vector<uint64_t> cumulative;
+
+    /** Inverse CDF of standard normal distribution */
+    std::vector<float> normal;
+};
+
+}}
+
+#endif  /* PEAKGENERATOR_H */
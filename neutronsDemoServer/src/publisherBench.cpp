@@ -0,0 +1,269 @@
+/* publisherBench.cpp
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <epicsGuard.h>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+
+#include <pv/channelProviderLocal.h>
+#include <pv/serverContext.h>
+#include <pvxs/client.h>
+#include <pvxs/server.h>
+
+#include "neutronServer.h"
+#include "pvDatabasePublisher.h"
+#include "pvxsPublisher.h"
+#include "nanoTimer.h"
+
+using namespace epics::neutronServer;
+using namespace epics::pvAccess;
+using namespace epics::pvDatabase;
+using namespace std;
+
+#define NS_BENCH_RECORD "neutrons:bench" /** Record served by both backends */
+
+/** Compare publication via pvDatabase and PVXS
+ *
+ *  For each event count, pulse rate and number of subscribers,
+ *  the event generator publishes for some seconds while PVXS client
+ *  subscriptions in this program receive the updates.
+ *  Reports the pulse and event rates received per subscriber, the latency from the
+ *  pulse time stamp until received, and the CPU load of the program,
+ *  which includes the subscribers.
+ */
+
+static void help(const char *name)
+{
+    cout << "USAGE: " << name << " [options]" << endl;
+    cout << "  -h        : Help" << endl;
+    cout << "  -b backend: 'pvdb' or 'pvxs' (default: both)" << endl;
+    cout << "  -e count  : Events per pulse (default: 1000, 100000, 1000000)" << endl;
+    cout << "  -r rate   : Pulses per second (default: 10, 60, 600)" << endl;
+    cout << "  -n subs   : Number of subscribers (default: 1, 4)" << endl;
+    cout << "  -t seconds: Duration of each run (default 5)" << endl;
+}
+
+/** Received updates of all subscriptions */
+class ReceiveStats
+{
+public:
+    ReceiveStats()
+    : pulses(0), events(0)
+    {}
+
+    void add(const pvxs::Value &update)
+    {
+        epicsTime now = epicsTime::getCurrent();
+        epicsTimeStamp stamp;
+        stamp.secPastEpoch = update["timeStamp.secondsPastEpoch"].as<uint32_t>();
+        stamp.nsec = update["timeStamp.nanoseconds"].as<uint32_t>();
+        double latency = now - epicsTime(stamp);
+        size_t count = update["time_of_flight.value"].as<pvxs::shared_array<const void>>().size();
+
+        epicsGuard<epicsMutex> guard(mutex);
+        ++pulses;
+        events += count;
+        latencies.add(latency > 0 ? static_cast<uint64_t>(latency * 1e9) : 0);
+    }
+
+    void clear()
+    {
+        epicsGuard<epicsMutex> guard(mutex);
+        pulses = events = 0;
+        latencies.clear();
+    }
+
+    epicsMutex mutex;
+    uint64_t pulses, events;
+    LatencyStats latencies;
+};
+
+/** @return User and system CPU seconds of this process */
+static double getCPUSeconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+}
+
+static void runWorkload(std::shared_ptr<EventPublisher> publisher,
+                        size_t count, double rate, size_t subscribers, double seconds)
+{
+    ReceiveStats stats;
+    pvxs::client::Context context = pvxs::client::Context::fromEnv();
+    vector<std::shared_ptr<pvxs::client::Subscription> > subscriptions;
+    for (size_t i=0; i<subscribers; ++i)
+        subscriptions.push_back(context.monitor(NS_BENCH_RECORD)
+                                .maskConnected(true)
+                                .maskDisconnected(true)
+                                .event([&stats](pvxs::client::Subscription &sub)
+                                {
+                                    try
+                                    {
+                                        while (pvxs::Value update = sub.pop())
+                                            stats.add(update);
+                                    }
+                                    catch (std::exception &ex)
+                                    {
+                                        cout << "Subscription error: " << ex.what() << endl;
+                                    }
+                                })
+                                .exec());
+
+    std::shared_ptr<FakeNeutronEventRunnable> runnable(
+        new FakeNeutronEventRunnable(NS_BENCH_RECORD, 1.0 / rate, count, false, false, 0));
+    runnable->setPublisher(publisher);
+    epicsThread thread(*runnable, "bench", epicsThreadGetStackSize(epicsThreadStackMedium));
+
+    // Allow subscriptions to connect, ignore their initial update
+    epicsThreadSleep(1.0);
+    stats.clear();
+
+    double cpu = getCPUSeconds();
+    epicsTime start = epicsTime::getCurrent();
+    thread.start();
+    epicsThreadSleep(seconds);
+    runnable->shutdown();
+    double elapsed = epicsTime::getCurrent() - start;
+    cpu = getCPUSeconds() - cpu;
+
+    for (size_t i=0; i<subscriptions.size(); ++i)
+        subscriptions[i]->cancel();
+    subscriptions.clear();
+
+    epicsGuard<epicsMutex> guard(stats.mutex);
+    cout << setw(10) << publisher->getName()
+         << setw(10) << count
+         << setw(8) << rate
+         << setw(6) << subscribers
+         << setw(12) << stats.pulses / subscribers / elapsed
+         << setw(12) << stats.events / subscribers / elapsed / 1e6
+         << setw(10) << stats.latencies.getPercentile(50) / 1e6
+         << setw(10) << stats.latencies.getPercentile(99) / 1e6
+         << setw(10) << stats.latencies.getMax() / 1e6
+         << setw(8) << 100.0 * cpu / elapsed
+         << endl;
+}
+
+static void runMatrix(std::shared_ptr<EventPublisher> publisher, const vector<size_t> &counts,
+                      const vector<double> &rates, const vector<size_t> &subscribers, double seconds)
+{
+    for (size_t c=0; c<counts.size(); ++c)
+        for (size_t r=0; r<rates.size(); ++r)
+            for (size_t s=0; s<subscribers.size(); ++s)
+                runWorkload(publisher, counts[c], rates[r], subscribers[s], seconds);
+}
+
+int main(int argc,char *argv[])
+{
+    bool pvdb = true, pvxs = true;
+    vector<size_t> counts, subscribers;
+    vector<double> rates;
+    double seconds = 5.0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:e:r:n:t:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            pvdb = string(optarg) == "pvdb";
+            pvxs = string(optarg) == "pvxs";
+            if (! (pvdb || pvxs))
+            {
+                cout << "Unknown backend '" << optarg << "'" << endl;
+                help(argv[0]);
+                return -1;
+            }
+            break;
+        case 'e':
+            counts.push_back((size_t)atol(optarg));
+            break;
+        case 'r':
+            rates.push_back(atof(optarg));
+            break;
+        case 'n':
+            subscribers.push_back((size_t)atol(optarg));
+            break;
+        case 't':
+            seconds = atof(optarg);
+            break;
+        case 'h':
+            help(argv[0]);
+            return 0;
+        default:
+            help(argv[0]);
+            return -1;
+        }
+    }
+    if (counts.empty())
+    {
+        counts.push_back(1000);
+        counts.push_back(100000);
+        counts.push_back(1000000);
+    }
+    if (rates.empty())
+    {
+        rates.push_back(10);
+        rates.push_back(60);
+        rates.push_back(600);
+    }
+    if (subscribers.empty())
+    {
+        subscribers.push_back(1);
+        subscribers.push_back(4);
+    }
+    for (size_t i=0; i<rates.size(); ++i)
+        if (rates[i] <= 0)
+        {
+            cout << "Pulse rate must be positive" << endl;
+            return -1;
+        }
+    for (size_t i=0; i<subscribers.size(); ++i)
+        if (subscribers[i] <= 0)
+        {
+            cout << "Need at least one subscriber" << endl;
+            return -1;
+        }
+
+    cout << "   backend    events    rate  subs    pulses/s  Mevents/s   p50 ms    p99 ms    max ms   CPU %" << endl;
+    if (pvdb)
+    {
+        std::shared_ptr<PVDatabasePublisher> publisher(new PVDatabasePublisher(NS_BENCH_RECORD));
+        PVDatabasePtr master = PVDatabase::getMaster();
+        ChannelProviderLocalPtr provider = getChannelProviderLocal();
+        if (! master->addRecord(publisher->getRecord()))
+            throw std::runtime_error("Cannot add record " NS_BENCH_RECORD);
+        ServerContext::shared_pointer server = startPVAServer(PVACCESS_ALL_PROVIDERS, 0, true, true);
+        runMatrix(publisher, counts, rates, subscribers, seconds);
+        server->shutdown();
+        master->removeRecord(publisher->getRecord());
+    }
+    if (pvxs)
+    {
+        std::shared_ptr<PVXSPublisher> publisher(new PVXSPublisher());
+        pvxs::server::Server server = pvxs::server::Config::from_env().build().addPV(NS_BENCH_RECORD, publisher->getRecord());
+        server.start();
+        runMatrix(publisher, counts, rates, subscribers, seconds);
+        server.stop();
+    }
+
+    return 0;
+}
@@ -0,0 +1,150 @@
+/* pulseDecimation.cpp
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#include <cstdlib>
+#include <iostream>
+#include "pulseDecimation.h"
+
+#ifndef USE_PVXS
+#   include <pv/pvData.h>
+#   include <pv/pvPlugin.h>
+    using namespace epics::pvData;
+    using namespace epics::pvCopy;
+#endif
+
+namespace epics { namespace neutronServer {
+
+bool PulseDecimation::parse(const std::string &option, const std::string &value)
+{
+    char *end;
+    if (option == "decimate")
+    {
+        long n = strtol(value.c_str(), &end, 0);
+        if (value.empty()  ||  *end != '\0'  ||  n < 1)
+            return false;
+        setDecimate(static_cast<size_t>(n));
+        return true;
+    }
+    if (option == "maxRate")
+    {
+        double rate = strtod(value.c_str(), &end);
+        if (value.empty()  ||  *end != '\0'  ||  rate <= 0)
+            return false;
+        setMaxRate(rate);
+        return true;
+    }
+    return false;
+}
+
+bool PulseDecimation::forward(const epicsTime &now)
+{
+    // Forward the first pulse, then skip decimate-1
+    if (skipped + 1 < decimate)
+    {
+        ++skipped;
+        return false;
+    }
+    if (max_rate > 0)
+    {
+        if (have_next  &&  now < next)
+        {
+            ++skipped;
+            return false;
+        }
+        // Keep the average rate when pulses arrive with jitter,
+        // but start over after a gap
+        double period = 1.0 / max_rate;
+        if (have_next  &&  now - next < period)
+            next += period;
+        else
+            next = now + period;
+        have_next = true;
+    }
+    skipped = 0;
+    return true;
+}
+
+#ifndef USE_PVXS
+// --------------------------------------------------------------------------------------------
+// pvRequest plugins
+//
+// PVCopy calls the filter of a subscription for its field before copying the field.
+// To drop a pulse, the filter clears the complete set of changes.
+// The remaining fields are then not copied, and since nothing changed,
+// no update is queued for the subscription.
+// --------------------------------------------------------------------------------------------
+
+/** Filter that drops pulses for one subscription */
+class PulseDecimationPVFilter : public PVFilter
+{
+public:
+    PulseDecimationPVFilter(const std::string &name, const PulseDecimation &decimation)
+    : name(name), decimation(decimation)
+    {}
+
+    bool filter(const PVFieldPtr & pvCopy, const BitSetPtr & bitSet, bool toCopy);
+
+    std::string getName()
+    {
+        return name;
+    }
+
+private:
+    std::string name;
+    PulseDecimation decimation;
+};
+
+bool PulseDecimationPVFilter::filter(const PVFieldPtr & pvCopy, const BitSetPtr & bitSet, bool toCopy)
+{
+    // Only decimate updates sent to the client
+    if (! toCopy)
+        return false;
+    // Forwarded pulses are copied as usual
+    if (decimation.forward(epicsTime::getCurrent()))
+        return false;
+    bitSet->clear();
+    return true;
+}
+
+/** Plugin that creates filters for "field.value[decimate=N]" or "field.value[maxRate=Hz]" */
+class PulseDecimationPlugin : public PVPlugin
+{
+public:
+    PulseDecimationPlugin(const std::string &name)
+    : name(name)
+    {}
+
+    PVFilterPtr create(const std::string & requestValue, const PVCopyPtr & pvCopy, const PVFieldPtr & master);
+
+private:
+    std::string name;
+};
+
+PVFilterPtr PulseDecimationPlugin::create(const std::string & requestValue, const PVCopyPtr & pvCopy, const PVFieldPtr & master)
+{
+    PulseDecimation decimation;
+    if (! decimation.parse(name, requestValue))
+    {
+        std::cout << name << ": Expected positive number, got '" << requestValue << "'" << std::endl;
+        return PVFilterPtr();
+    }
+    return PVFilterPtr(new PulseDecimationPVFilter(name, decimation));
+}
+
+void registerPulseDecimationPlugins()
+{
+    static bool registered = false;
+    if (registered)
+        return;
+    registered = true;
+    PVPluginRegistry::registerPlugin("decimate", PVPluginPtr(new PulseDecimationPlugin("decimate")));
+    PVPluginRegistry::registerPlugin("maxRate", PVPluginPtr(new PulseDecimationPlugin("maxRate")));
+}
+#endif // USE_PVXS
+
+}} // namespace neutronServer, epics
@@ -0,0 +1,76 @@
+/* pulseDecimation.h
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#ifndef PULSEDECIMATION_H
+#define PULSEDECIMATION_H
+
+#include <cstddef>
+#include <string>
+#include <epicsTime.h>
+
+namespace epics { namespace neutronServer {
+
+/** Decides which pulses to forward to one slow subscriber */
+class PulseDecimation
+{
+public:
+    PulseDecimation()
+    : decimate(1), max_rate(0.0), skipped(0), have_next(false)
+    {}
+
+    /** Forward only every Nth pulse, 1 for all.
+     *  The next pulse is forwarded, so new subscribers get an initial value
+     */
+    void setDecimate(size_t decimate)
+    {
+        this->decimate = decimate > 0 ? decimate : 1;
+        skipped = this->decimate - 1;
+    }
+
+    /** Forward at most 'rate' pulses per second, 0 for no limit */
+    void setMaxRate(double rate)
+    {
+        max_rate = rate > 0 ? rate : 0.0;
+    }
+
+    /** Parse option of a "decimate=N" or "maxRate=Hz" request
+     *  @return true on success
+     */
+    bool parse(const std::string &option, const std::string &value);
+
+    /** @param now Time of the pulse
+     *  @return true if pulse should be forwarded, false to drop it
+     */
+    bool forward(const epicsTime &now);
+
+private:
+    size_t decimate;
+    double max_rate;
+    /** Pulses skipped since the last forwarded one */
+    size_t skipped;
+    /** Earliest time for the next forwarded pulse when rate limited */
+    bool have_next;
+    epicsTime next;
+};
+
+#ifndef USE_PVXS
+/** Register the 'decimate' and 'maxRate' pvRequest plugins
+ *
+ *  Clients can then request every Nth pulse or a limited rate via
+ *  "field(timeStamp,time_of_flight.value[decimate=10],pixel.value)"
+ *  or "field(timeStamp,time_of_flight.value[maxRate=5],pixel.value)".
+ *  Apply to one field, the first array, of the request:
+ *  Skipped pulses are dropped before the following fields are copied
+ *  and before the update is queued for the subscription.
+ */
+void registerPulseDecimationPlugins();
+#endif
+
+}}
+
+#endif  /* PULSEDECIMATION_H */
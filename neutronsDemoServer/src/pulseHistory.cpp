@@ -0,0 +1,260 @@
+/* pulseHistory.cpp
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#include <iostream>
+#include <epicsGuard.h>
+#include "pulseHistory.h"
+
+#ifdef USE_PVXS
+#    include <pvxs/nt.h>
+     using namespace pvxs;
+#else
+#   include <pv/standardField.h>
+#   include <pv/pvTimeStamp.h>
+     using namespace epics::pvData;
+     using namespace epics::pvAccess;
+     using namespace std;
+#endif
+
+namespace epics { namespace neutronServer {
+
+PulseHistory::PulseHistory(size_t max_pulses, size_t max_bytes)
+: max_pulses(max_pulses), max_bytes(max_bytes), bytes(0)
+{
+}
+
+void PulseHistory::addPulse(uint64_t id, double charge, EventArray tof, EventArray pixel)
+{
+    HistoricPulse pulse;
+    pulse.id = id;
+    pulse.time = epicsTime::getCurrent();
+    pulse.charge = charge;
+    pulse.tof = tof;
+    pulse.pixel = pixel;
+
+    epicsGuard<epicsMutex> guard(mutex);
+    pulses.push_back(pulse);
+    bytes += pulse.getBytes();
+    // Drop oldest pulses, but always keep the newest one
+    while (pulses.size() > 1  &&
+           (pulses.size() > max_pulses  ||  bytes > max_bytes))
+    {
+        bytes -= pulses.front().getBytes();
+        pulses.pop_front();
+    }
+}
+
+void PulseHistory::shutdown()
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    pulses.clear();
+    bytes = 0;
+}
+
+void PulseHistory::getPulses(uint64_t start, uint64_t end, std::vector<HistoricPulse> &result,
+                             uint64_t &first_id, uint64_t &last_id)
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    if (pulses.empty())
+    {
+        first_id = last_id = 0;
+        return;
+    }
+    first_id = pulses.front().id;
+    last_id = pulses.back().id;
+    // IDs may restart via setID(), so check each pulse
+    for (std::deque<HistoricPulse>::const_iterator pulse = pulses.begin();
+         pulse != pulses.end()  &&  result.size() < NS_HISTORY_MAX_REPLY;
+         ++pulse)
+        if (pulse->id >= start  &&  pulse->id <= end)
+            result.push_back(*pulse);
+}
+
+
+#ifdef USE_PVXS
+
+/** Get 'start' or 'end' from arguments or NTURI query */
+static uint64_t getPulseID(const Value &args, const char *name, uint64_t default_id)
+{
+    Value id = args[std::string("query.") + name];
+    if (! id.valid())
+        id = args[name];
+    if (! id.valid())
+        return default_id;
+    return id.as<uint64_t>();
+}
+
+pvxs::server::SharedPV PulseHistory::createPV()
+{
+    using namespace pvxs::members;
+
+    TypeDef reply_type(TypeCode::Struct, {
+        UInt64("first_id"),
+        UInt64("last_id"),
+        StructA("pulses", {
+            UInt64("id"),
+            Struct("timeStamp", "time_t", {
+                Int64("secondsPastEpoch"),
+                Int32("nanoseconds"),
+                Int32("userTag"),
+            }),
+            Float64("proton_charge"),
+            UInt32A("time_of_flight"),
+            UInt32A("pixel"),
+        }),
+    });
+
+    server::SharedPV pv(server::SharedPV::buildReadonly());
+    pv.onRPC([this, reply_type](server::SharedPV&, std::unique_ptr<server::ExecOp>&& op, Value&& args)
+    {
+        uint64_t start = getPulseID(args, "start", 0);
+        uint64_t end = getPulseID(args, "end", start);
+        std::vector<HistoricPulse> found;
+        uint64_t first_id, last_id;
+        getPulses(start, end, found, first_id, last_id);
+
+        Value reply = reply_type.create();
+        reply["first_id"] = first_id;
+        reply["last_id"] = last_id;
+        shared_array<Value> items(found.size());
+        for (size_t i=0; i<found.size(); ++i)
+        {
+            items[i] = reply["pulses"].allocMember();
+            items[i]["id"] = found[i].id;
+            items[i]["timeStamp.secondsPastEpoch"] = found[i].time.secPastEpoch + POSIX_TIME_AT_EPICS_EPOCH;
+            items[i]["timeStamp.nanoseconds"] = found[i].time.nsec;
+            items[i]["timeStamp.userTag"] = found[i].id;
+            items[i]["proton_charge"] = found[i].charge;
+            items[i]["time_of_flight"] = found[i].tof;
+            items[i]["pixel"] = found[i].pixel;
+        }
+        reply["pulses"] = items.freeze();
+        op->reply(reply);
+    });
+    pv.open(reply_type.create());
+    return pv;
+}
+
+#else // !defined(USE_PVXS)
+
+/** RPC service for the PulseHistory */
+class PulseHistoryService : public RPCService
+{
+public:
+    PulseHistoryService(PulseHistory &history);
+
+    PVStructurePtr request(PVStructurePtr const & args);
+
+private:
+    uint64 getPulseID(PVStructurePtr const & args, const string &name, uint64 default_id);
+
+    PulseHistory &history;
+    StructureConstPtr pulse_type, reply_type;
+};
+
+PulseHistoryService::PulseHistoryService(PulseHistory &history)
+: history(history)
+{
+    pulse_type = getFieldCreate()->createFieldBuilder()
+        ->add("id", pvULong)
+        ->add("timeStamp", getStandardField()->timeStamp())
+        ->add("proton_charge", pvDouble)
+        ->addArray("time_of_flight", pvUInt)
+        ->addArray("pixel", pvUInt)
+        ->createStructure();
+    reply_type = getFieldCreate()->createFieldBuilder()
+        ->add("first_id", pvULong)
+        ->add("last_id", pvULong)
+        ->addArray("pulses", pulse_type)
+        ->createStructure();
+}
+
+uint64 PulseHistoryService::getPulseID(PVStructurePtr const & args, const string &name, uint64 default_id)
+{
+    PVScalarPtr id = args->getSubField<PVScalar>("query." + name);
+    if (! id)
+        id = args->getSubField<PVScalar>(name);
+    if (! id)
+        return default_id;
+    try
+    {
+        return id->getAs<uint64>();
+    }
+    catch (std::exception &ex)
+    {
+        throw RPCRequestException(Status::STATUSTYPE_ERROR, "Invalid '" + name + "': " + ex.what());
+    }
+}
+
+PVStructurePtr PulseHistoryService::request(PVStructurePtr const & args)
+{
+    uint64 start = getPulseID(args, "start", 0);
+    uint64 end = getPulseID(args, "end", start);
+    std::vector<HistoricPulse> found;
+    uint64_t first_id, last_id;
+    history.getPulses(start, end, found, first_id, last_id);
+
+    PVStructurePtr reply = getPVDataCreate()->createPVStructure(reply_type);
+    reply->getSubField<PVULong>("first_id")->put(first_id);
+    reply->getSubField<PVULong>("last_id")->put(last_id);
+
+    PVStructureArray::svector items(found.size());
+    for (size_t i=0; i<found.size(); ++i)
+    {
+        items[i] = getPVDataCreate()->createPVStructure(pulse_type);
+        items[i]->getSubField<PVULong>("id")->put(found[i].id);
+        TimeStamp time(found[i].time.secPastEpoch + POSIX_TIME_AT_EPICS_EPOCH, found[i].time.nsec,
+                       static_cast<int32>(found[i].id));
+        PVTimeStamp pvTime;
+        pvTime.attach(items[i]->getSubField("timeStamp"));
+        pvTime.set(time);
+        items[i]->getSubField<PVDouble>("proton_charge")->put(found[i].charge);
+        // Share the frozen arrays, no copy
+        items[i]->getSubField<PVUIntArray>("time_of_flight")->replace(found[i].tof);
+        items[i]->getSubField<PVUIntArray>("pixel")->replace(found[i].pixel);
+    }
+    reply->getSubField<PVStructureArray>("pulses")->replace(freeze(items));
+    return reply;
+}
+
+/** Record that serves the PulseHistoryService via channelRPC */
+class PulseHistoryRecord : public epics::pvDatabase::PVRecord
+{
+public:
+    PulseHistoryRecord(string const & recordName, PVStructurePtr const & pvStructure,
+                       RPCService::shared_pointer service)
+    : PVRecord(recordName, pvStructure), service(service)
+    {}
+
+    Service::shared_pointer getService(PVStructurePtr const & pvRequest)
+    {
+        return service;
+    }
+
+private:
+    RPCService::shared_pointer service;
+};
+
+epics::pvDatabase::PVRecordPtr PulseHistory::createRecord(string const & record_name)
+{
+    PVStructurePtr pvStructure = getPVDataCreate()->createPVStructure(
+        getFieldCreate()->createFieldBuilder()
+            ->add("first_id", pvULong)
+            ->add("last_id", pvULong)
+            ->createStructure());
+    epics::pvDatabase::PVRecordPtr record(
+        new PulseHistoryRecord(record_name, pvStructure,
+                               RPCService::shared_pointer(new PulseHistoryService(*this))));
+    if (! record->init())
+        record.reset();
+    return record;
+}
+
+#endif // USE_PVXS
+
+}} // namespace neutronServer, epics
@@ -0,0 +1,92 @@
+/* pulseHistory.h
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#ifndef PULSEHISTORY_H
+#define PULSEHISTORY_H
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+
+#include "neutronServer.h"
+
+#ifdef USE_PVXS
+#    include <pvxs/data.h>
+#    include <pvxs/sharedpv.h>
+#else
+#    include <pv/pvData.h>
+#    include <pv/rpcService.h>
+#    include <pv/pvDatabase.h>
+#endif
+
+namespace epics { namespace neutronServer {
+
+#define NS_HISTORY_PULSES    1000      /** Default number of pulses kept in history */
+#define NS_HISTORY_BYTES     500000000 /** Default max. bytes of event data kept in history */
+#define NS_HISTORY_MAX_REPLY 100       /** Max number of pulses returned for one request */
+
+/** One pulse in the history, sharing the frozen arrays of the record */
+struct HistoricPulse
+{
+    uint64_t id;
+    epicsTimeStamp time;
+    double charge;
+    EventArray tof;
+    EventArray pixel;
+
+    size_t getBytes() const
+    {
+        return (tof.size() + pixel.size()) * sizeof(uint32_t);
+    }
+};
+
+/** Keeps the most recent pulses, bounded by count and by bytes
+ *
+ *  Holds references to the frozen arrays, no copies.
+ *  Clients that missed pulses can fetch them via RPC,
+ *  passing the 'start' and optional 'end' pulse ID,
+ *  either as top-level arguments or in the 'query' of an NTURI:
+ *
+ *     pvcall neutrons:history start=100 end=105
+ */
+class PulseHistory : public PulseConsumer
+{
+public:
+    PulseHistory(size_t max_pulses, size_t max_bytes);
+
+    void addPulse(uint64_t id, double charge, EventArray tof, EventArray pixel);
+
+    void shutdown();
+
+    /** Get pulses with start <= id <= end, at most NS_HISTORY_MAX_REPLY
+     *  @param first_id, last_id Set to the pulse IDs currently in history, 0 if empty
+     */
+    void getPulses(uint64_t start, uint64_t end, std::vector<HistoricPulse> &pulses,
+                   uint64_t &first_id, uint64_t &last_id);
+
+#ifdef USE_PVXS
+    /** Create PV that handles RPC requests */
+    pvxs::server::SharedPV createPV();
+#else
+    /** Create record that handles RPC requests via the local channel provider */
+    epics::pvDatabase::PVRecordPtr createRecord(std::string const & record_name);
+#endif
+
+private:
+    size_t max_pulses, max_bytes;
+    epicsMutex mutex;
+    std::deque<HistoricPulse> pulses;
+    size_t bytes;
+};
+
+}}
+
+#endif  /* PULSEHISTORY_H */
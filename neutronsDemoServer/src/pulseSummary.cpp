@@ -0,0 +1,119 @@
+/* pulseSummary.cpp
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#include <algorithm>
+#include <epicsGuard.h>
+#include "pulseSummary.h"
+
+namespace epics { namespace neutronServer {
+
+void SummaryHistogram::add(const EventArray &tof, const EventArray &pixel)
+{
+    const uint32_t *t = tof.data();
+    const uint32_t *p = pixel.data();
+    const size_t count = std::min(tof.size(), pixel.size());
+    const size_t bins = histogram.size();
+    uint32_t *h = &histogram[0];
+    uint64_t bank1 = 0, bank2 = 0;
+    for (size_t i=0; i<count; ++i)
+    {
+        // Time-of-flight beyond NS_TOF_MAX lands in the last bin
+        size_t bin = static_cast<uint64_t>(t[i]) * bins / NS_TOF_MAX;
+        ++h[bin < bins ? bin : bins-1];
+        // Banks are half-open ranges, as created by the generators
+        if (p[i] >= NS_ID_MIN1  &&  p[i] < NS_ID_MAX1)
+            ++bank1;
+        else if (p[i] >= NS_ID_MIN2  &&  p[i] < NS_ID_MAX2)
+            ++bank2;
+    }
+    banks[0] += bank1;
+    banks[1] += bank2;
+    banks[2] += count - bank1 - bank2;
+}
+
+void SummaryHistogram::moveInto(std::vector<double> &histogram, std::vector<double> &banks)
+{
+    for (size_t i=0; i<this->histogram.size(); ++i)
+        histogram[i] = this->histogram[i];
+    for (size_t i=0; i<this->banks.size(); ++i)
+        banks[i] = this->banks[i];
+    std::fill(this->histogram.begin(), this->histogram.end(), 0);
+    std::fill(this->banks.begin(), this->banks.end(), 0);
+}
+
+
+PulseSummary::PulseSummary(size_t tof_bins, double period)
+: tof_bins(tof_bins > 0 ? tof_bins : 1), period(period), next_publish(epicsTime::getCurrent()),
+  pool(WorkPool::getDefault()), summarizer(new SummaryHistogram(this->tof_bins)),
+  histogram(this->tof_bins, 0.0), banks(NS_SUMMARY_BANKS, 0.0)
+{
+}
+
+PulseSummary::~PulseSummary()
+{
+    shutdown();
+}
+
+void PulseSummary::setListener(std::function<void ()> listener)
+{   // Call before starting the generator thread
+    this->listener = listener;
+}
+
+void PulseSummary::setPeriod(double seconds)
+{   // No locking..
+    period = seconds;
+}
+
+void PulseSummary::addPulse(uint64_t id, double charge, EventArray tof, EventArray pixel)
+{
+    // Previous pulse needs to be done before the next task can add to the counts.
+    // The task holds the pulse until it completes.
+    pool.wait(pending);
+    std::shared_ptr<SummaryHistogram> summarizer = this->summarizer;
+    pool.submit(pending, [summarizer, tof, pixel]()
+    {
+        summarizer->add(tof, pixel);
+    });
+
+    epicsTime now = epicsTime::getCurrent();
+    if (now >= next_publish)
+    {
+        next_publish = now + period;
+        publish();
+    }
+}
+
+void PulseSummary::publish()
+{
+    pool.wait(pending);
+    {
+        epicsGuard<epicsMutex> guard(mutex);
+        summarizer->moveInto(histogram, banks);
+    }
+    if (listener)
+        listener();
+}
+
+void PulseSummary::getTOFHistogram(std::vector<double> &histogram)
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    histogram = this->histogram;
+}
+
+void PulseSummary::getBankCounts(std::vector<double> &banks)
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    banks = this->banks;
+}
+
+void PulseSummary::shutdown()
+{
+    pool.wait(pending);
+}
+
+}} // namespace neutronServer, epics
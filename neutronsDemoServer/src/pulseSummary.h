@@ -0,0 +1,104 @@
+/* pulseSummary.h
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#ifndef PULSESUMMARY_H
+#define PULSESUMMARY_H
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+#include <workerRunnable.h>
+
+#include "neutronServer.h"
+
+namespace epics { namespace neutronServer {
+
+#define NS_SUMMARY_TOF_BINS 1000 /** Default number of time-of-flight bins over 0 .. NS_TOF_MAX */
+#define NS_SUMMARY_BANKS    3    /** Event counts for detector bank 1, bank 2 and pixels outside both banks */
+
+/** Private TOF histogram and bank counts, added to by WorkPool tasks */
+class SummaryHistogram
+{
+public:
+    SummaryHistogram(size_t tof_bins)
+    : histogram(tof_bins, 0), banks(NS_SUMMARY_BANKS, 0)
+    {}
+
+    /** Add a pulse */
+    void add(const EventArray &tof, const EventArray &pixel);
+
+    /** Move private counts into histogram and banks, then clear them.
+     *  Must only be called when no task is adding to it.
+     */
+    void moveInto(std::vector<double> &histogram, std::vector<double> &banks);
+
+private:
+    std::vector<uint32_t> histogram;
+    std::vector<uint64_t> banks;
+};
+
+/** Reduced view of the event stream for Channel Access clients
+ *
+ *  Each pulse is added to a time-of-flight histogram and to event counts per
+ *  detector bank by a task on the shared WorkPool.
+ *  At a (lower) configurable rate, the counts of the last period are published
+ *  and the listener is notified.
+ */
+class PulseSummary : public PulseConsumer
+{
+public:
+    PulseSummary(size_t tof_bins, double period);
+    ~PulseSummary();
+
+    /** Call listener from the generator thread whenever a new summary is available.
+     *  Call before starting the generator thread
+     */
+    void setListener(std::function<void ()> listener);
+
+    /** Set seconds between summary updates */
+    void setPeriod(double seconds);
+
+    /** Add events of a pulse. Called by the event generator thread */
+    void addPulse(uint64_t id, double charge, EventArray tof, EventArray pixel);
+
+    /** Wait for the pending histogram task */
+    void shutdown();
+
+    /** @return Number of time-of-flight bins */
+    size_t getTOFBins() const
+    {
+        return tof_bins;
+    }
+
+    /** Get events per time-of-flight bin during the last period */
+    void getTOFHistogram(std::vector<double> &histogram);
+
+    /** Get events per detector bank during the last period, see NS_SUMMARY_BANKS */
+    void getBankCounts(std::vector<double> &banks);
+
+private:
+    void publish();
+
+    size_t tof_bins;
+    double period;
+    epicsTime next_publish;
+    std::function<void ()> listener;
+    WorkPool &pool;
+    /** Histogram task of the last pulse */
+    WorkGroup pending;
+    std::shared_ptr<SummaryHistogram> summarizer;
+    /** Published summary */
+    epicsMutex mutex;
+    std::vector<double> histogram, banks;
+};
+
+}}
+
+#endif  /* PULSESUMMARY_H */
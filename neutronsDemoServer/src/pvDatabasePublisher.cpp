@@ -0,0 +1,185 @@
+/* pvDatabasePublisher.cpp
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * Based on MRK pvDataBaseCPP exampleServer
+ *
+ * @author Kay Kasemir
+ */
+#include <iostream>
+#include <pv/standardField.h>
+#include <pv/standardPVField.h>
+#include "pvDatabasePublisher.h"
+
+using namespace epics::pvData;
+using namespace epics::pvDatabase;
+using namespace std;
+
+namespace epics { namespace neutronServer {
+
+NeutronPVRecord::shared_pointer NeutronPVRecord::create(string const & recordName,
+                                                        bool narrow_pixel, bool narrow_tof)
+{
+    FieldCreatePtr fieldCreate = getFieldCreate();
+    StandardFieldPtr standardField = getStandardField();
+    PVDataCreatePtr pvDataCreate = getPVDataCreate();
+
+    // Create the data structure that the PVRecord should use
+    FieldBuilderPtr builder = fieldCreate->createFieldBuilder()
+        ->add("timeStamp", standardField->timeStamp())
+        // Demo for manual setup of structure, could use
+        // add("proton_charge", standardField->scalar(pvDouble, ""))
+        ->addNestedStructure("proton_charge")
+            ->setId("epics:nt/NTScalar:1.0")
+            ->add("value", pvDouble)
+        ->endNested()
+        ->addNestedStructure("time_of_flight")
+            ->setId("epics:nt/NTScalarArray:1.0")
+            ->addArray("value", narrow_tof ? pvUShort : pvUInt);
+    // Narrow time-of-flight values need to be multiplied by scale
+    if (narrow_tof)
+        builder = builder->add("scale", pvUInt);
+    builder = builder->endNested()
+        ->add("pixel", standardField->scalarArray(narrow_pixel ? pvUShort : pvUInt, ""));
+    PVStructurePtr pvStructure = pvDataCreate->createPVStructure(builder->createStructure());
+
+    NeutronPVRecord::shared_pointer pvRecord(new NeutronPVRecord(recordName, pvStructure));
+    if (!pvRecord->init())
+        pvRecord.reset();
+    return pvRecord;
+}
+
+NeutronPVRecord::NeutronPVRecord(string const & recordName, PVStructurePtr const & pvStructure)
+: PVRecord(recordName,pvStructure), pulse_id(0)
+{
+}
+
+bool NeutronPVRecord::init()
+{
+    initPVRecord();
+
+    // Fetch pointers into the records pvData which will be used to update the values
+    if (!pvTimeStamp.attach(getPVStructure()->getSubField("timeStamp")))
+        return false;
+
+    pvProtonCharge = getPVStructure()->getSubField<PVDouble>("proton_charge.value");
+    if (pvProtonCharge.get() == NULL)
+        return false;
+
+    pvTimeOfFlight = getPVStructure()->getSubField<PVScalarArray>("time_of_flight.value");
+    if (pvTimeOfFlight.get() == NULL)
+        return false;
+
+    PVUIntPtr pvScale = getPVStructure()->getSubField<PVUInt>("time_of_flight.scale");
+    if (pvScale)
+        pvScale->put(NS_NARROW_TOF_SCALE);
+
+    pvPixel = getPVStructure()->getSubField<PVScalarArray>("pixel.value");
+    if (pvPixel.get() == NULL)
+        return false;
+
+    return true;
+}
+
+void NeutronPVRecord::process()
+{
+    // Update timestamp
+    timeStamp.getCurrent();
+    // pulse_id is unsigned, put into userTag as signed?
+    timeStamp.setUserTag(static_cast<int>(pulse_id));
+    pvTimeStamp.set(timeStamp);
+}
+
+void NeutronPVRecord::update(uint64 id, double charge,
+                             shared_vector<const uint32> tof,
+                             shared_vector<const uint32> pixel)
+{
+    update(id, charge, static_shared_vector_cast<const void>(tof), static_shared_vector_cast<const void>(pixel));
+}
+
+void NeutronPVRecord::update(uint64 id, double charge,
+                             shared_vector<const void> tof,
+                             shared_vector<const void> pixel)
+{
+    // Prepare next time stamp off-lock
+    TimeStamp next_time;
+    next_time.getCurrent();
+    // pulse_id is unsigned, put into userTag as signed?
+    next_time.setUserTag(static_cast<int>(id));
+
+    // Arrays of the previous pulse, released after unlock
+    shared_vector<const void> previous_tof, previous_pixel;
+
+    uint64_t start = NanoTimer::getCurrentNanosecs();
+    lock();
+    uint64_t locked = NanoTimer::getCurrentNanosecs();
+    try
+    {
+        beginGroupPut();
+        pulse_id = id;
+        timeStamp = next_time;
+        pvProtonCharge->put(charge);
+        pvTimeOfFlight->getAs(previous_tof);
+        pvPixel->getAs(previous_pixel);
+        pvTimeOfFlight->putFrom(tof);
+        pvPixel->putFrom(pixel);
+
+        // TODO Create server-side overrun by updating same field
+        // multiple times within one 'group put'
+        // pvPulseID->put(id);
+
+        pvTimeStamp.set(timeStamp);
+        endGroupPut();
+    }
+    catch(...)
+    {
+        unlock();
+        throw;
+    }
+    uint64_t end = NanoTimer::getCurrentNanosecs();
+    unlock();
+    lock_wait.add(locked - start);
+    lock_hold.add(end - locked);
+}
+
+void NeutronPVRecord::reportLockTimes()
+{
+    if (lock_hold.getCount() <= 0)
+        return;
+    std::cout << "Record lock wait p50 " << lock_wait.getPercentile(50) / 1000
+              << " us, p99 " << lock_wait.getPercentile(99) / 1000
+              << " us, max " << lock_wait.getMax() / 1000
+              << " us; hold p50 " << lock_hold.getPercentile(50) / 1000
+              << " us, p99 " << lock_hold.getPercentile(99) / 1000
+              << " us, max " << lock_hold.getMax() / 1000 << " us" << std::endl;
+    lock_wait.clear();
+    lock_hold.clear();
+}
+PVDatabasePublisher::PVDatabasePublisher(const std::string &record_name, bool narrow_pixel, bool narrow_tof)
+: record(NeutronPVRecord::create(record_name, narrow_pixel, narrow_tof))
+{
+}
+
+/** @return pvData array that shares the memory of the events */
+static shared_vector<const void> toVector(const PublishedEvents &events)
+{
+    if (events.narrow)
+        return static_shared_vector_cast<const void>(
+            shared_vector<const uint16>(std::static_pointer_cast<const uint16>(events.data), 0, events.count));
+    return static_shared_vector_cast<const void>(
+        shared_vector<const uint32>(std::static_pointer_cast<const uint32>(events.data), 0, events.count));
+}
+
+void PVDatabasePublisher::publish(uint64_t id, double charge, const PublishedEvents &tof, const PublishedEvents &pixel)
+{
+    record->update(id, charge, toVector(tof), toVector(pixel));
+}
+
+void PVDatabasePublisher::report()
+{
+    record->reportLockTimes();
+}
+
+}} // namespace neutronServer, epics
@@ -0,0 +1,121 @@
+/* pvDatabasePublisher.h
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * Based on MRK pvDataBaseCPP exampleServer
+ *
+ * @author Kay Kasemir
+ */
+#ifndef PVDATABASEPUBLISHER_H
+#define PVDATABASEPUBLISHER_H
+
+#include <string>
+#include <pv/pvDatabase.h>
+#include <pv/timeStamp.h>
+#include <pv/pvTimeStamp.h>
+
+#include "eventPublisher.h"
+#include "nanoTimer.h"
+
+namespace epics { namespace neutronServer {
+
+/** Record that serves this type of pvData:
+ *
+ *  structure
+ *      // Time stamp for everything in this structure,
+ *      // userTag is sequential number to check for missed
+ *      // updates
+ *      time_t  timeStamp
+ *      NTScalar proton_charge
+ *          double  value
+ *      NTScalarArray time_of_flight
+ *          uint[]  value
+ *      NTScalarArray pixel
+ *          uint[]  value
+ *
+ *  The narrow layout uses ushort[] for the pixel and/or time-of-flight values.
+ *  Narrow time-of-flight values are divided by NS_NARROW_TOF_SCALE,
+ *  which is provided as time_of_flight.scale.
+ */
+class NeutronPVRecord : public epics::pvDatabase::PVRecord
+{
+public:
+    POINTER_DEFINITIONS(NeutronPVRecord);
+
+    // PVRecord methods
+    static NeutronPVRecord::shared_pointer create(std::string const & recordName,
+                                                  bool narrow_pixel = false, bool narrow_tof = false);
+    virtual bool init();
+    virtual void process();
+
+    /** Update the values of the record */
+    void update(epics::pvData::uint64 id, double charge,
+                epics::pvData::shared_vector<const epics::pvData::uint32> tof,
+                epics::pvData::shared_vector<const epics::pvData::uint32> pixel);
+
+    /** Update the values of the record
+     *
+     *  Arrays that match the element type of the record are shared,
+     *  others are converted.
+     *
+     *  The time stamp is prepared before locking the record,
+     *  and the arrays of the previous pulse are released after unlocking,
+     *  so the lock is only held to swap the values and notify monitors.
+     */
+    void update(epics::pvData::uint64 id, double charge, epics::pvData::shared_vector<const void> tof,
+                epics::pvData::shared_vector<const void> pixel);
+
+    /** Show how long update() waited for the record lock and held it
+     *  since the last report, then reset.
+     *  Call from the thread that calls update()
+     */
+    void reportLockTimes();
+
+private:
+    NeutronPVRecord(std::string const & recordName,
+                    epics::pvData::PVStructurePtr const & pvStructure);
+
+    // Time of last process() call
+    epics::pvData::TimeStamp      timeStamp;
+    epics::pvData::uint32         pulse_id;
+
+    // Pointers in to the records' data structure
+    epics::pvData::PVTimeStamp    pvTimeStamp;
+    epics::pvData::PVDoublePtr    pvProtonCharge;
+    epics::pvData::PVScalarArrayPtr pvTimeOfFlight;
+    epics::pvData::PVScalarArrayPtr pvPixel;
+
+    // Lock times of update()
+    LatencyStats lock_wait, lock_hold;
+};
+
+/** Publishes pulses via a NeutronPVRecord */
+class PVDatabasePublisher : public EventPublisher
+{
+public:
+    PVDatabasePublisher(const std::string &record_name, bool narrow_pixel = false, bool narrow_tof = false);
+
+    NeutronPVRecord::shared_pointer getRecord()
+    {
+        return record;
+    }
+
+    const char *getName() const
+    {
+        return "pvDatabase";
+    }
+
+    void publish(uint64_t id, double charge, const PublishedEvents &tof, const PublishedEvents &pixel);
+
+    /** Show record lock times */
+    void report();
+
+private:
+    NeutronPVRecord::shared_pointer record;
+};
+
+}}
+
+#endif  /* PVDATABASEPUBLISHER_H */
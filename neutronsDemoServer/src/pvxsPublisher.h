@@ -0,0 +1,100 @@
+/* pvxsPublisher.h
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#ifndef PVXSPUBLISHER_H
+#define PVXSPUBLISHER_H
+
+#include <pvxs/data.h>
+#include <pvxs/server.h>
+#include <pvxs/sharedpv.h>
+
+#include "eventPublisher.h"
+
+namespace epics { namespace neutronServer {
+
+/** Type of the neutron event record, see NeutronPVRecord */
+struct Neutrons {
+    // We don't have to define Neutrons structure here,
+    // but we do it for completness and comparison with NeutronPVRecord
+
+    bool narrow_pixel, narrow_tof;
+
+    explicit Neutrons(bool narrow_pixel = false, bool narrow_tof = false)
+    : narrow_pixel(narrow_pixel), narrow_tof(narrow_tof)
+    {}
+
+    //! A TypeDef which can be appended
+    PVXS_API
+    pvxs::TypeDef build() const
+    {
+        using namespace pvxs;
+        using namespace pvxs::members;
+
+        Member time_of_flight = Struct("time_of_flight", "epics:nt/NTScalarArray:1.0", {
+            narrow_tof ? UInt16A("value") : UInt32A("value")
+        });
+        if (narrow_tof)
+            time_of_flight.addChild(UInt32("scale"));
+
+        TypeDef def(
+            TypeCode::Struct,
+            {
+                Struct("timeStamp", "time_t", {
+                    Int64("secondsPastEpoch"),
+                    Int32("nanoseconds"),
+                    Int32("userTag"),
+                }),
+                time_of_flight,
+                Struct("pixel", "epics:nt/NTScalarArray:1.0", {
+                    narrow_pixel ? UInt16A("value") : UInt32A("value")
+                }),
+                Struct("proton_charge", "epics:nt/NTScalar:1.0", {
+                    Float64("value")
+                }),
+            }
+        );
+
+        return def;
+    }
+    //! Instanciate
+    inline pvxs::Value create() const {
+        return build().create();
+    }
+};
+
+
+/** Publishes pulses via a PVXS SharedPV */
+class PVXSPublisher : public EventPublisher
+{
+public:
+    PVXSPublisher(bool narrow_pixel = false, bool narrow_tof = false);
+
+    pvxs::server::SharedPV& getRecord()
+    {
+        return record;
+    }
+
+    const char *getName() const
+    {
+        return "PVXS";
+    }
+
+    void publish(uint64_t id, double charge, const PublishedEvents &tof, const PublishedEvents &pixel);
+
+private:
+    pvxs::server::SharedPV record;
+
+    // Update that's re-used for each pulse, with its fields resolved once
+    pvxs::Value update;
+    pvxs::Value update_seconds, update_nanoseconds, update_user_tag;
+    pvxs::Value update_charge, update_tof, update_pixel;
+};
+
+}}
+
+#endif  /* PVXSPUBLISHER_H */
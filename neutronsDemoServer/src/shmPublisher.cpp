@@ -0,0 +1,31 @@
+/* shmPublisher.cpp
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#include <algorithm>
+#include <iostream>
+#include "shmPublisher.h"
+
+namespace epics { namespace neutronServer {
+
+bool ShmPublisher::init(const std::string &name, size_t slots, size_t max_events)
+{
+    return ring.create(name, slots, max_events);
+}
+
+void ShmPublisher::addPulse(uint64_t id, double charge, EventArray tof, EventArray pixel)
+{
+    ring.write(id, charge, tof.data(), pixel.data(), std::min(tof.size(), pixel.size()));
+}
+
+void ShmPublisher::shutdown()
+{
+    if (ring.getTruncated() > 0)
+        std::cout << "Shared memory: " << ring.getTruncated() << " pulses were truncated" << std::endl;
+}
+
+}} // namespace neutronServer, epics
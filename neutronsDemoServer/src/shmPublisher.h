@@ -0,0 +1,41 @@
+/* shmPublisher.h
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#ifndef SHMPUBLISHER_H
+#define SHMPUBLISHER_H
+
+#include <string>
+
+#include "neutronServer.h"
+#include "shmTransport.h"
+
+namespace epics { namespace neutronServer {
+
+/** Writes each pulse into a shared memory ring for clients on the same host
+ *
+ *  Each pulse is copied once into the ring.
+ *  Clients map the ring read-only and process the events in place,
+ *  without pvAccess serialization or network copies.
+ */
+class ShmPublisher : public PulseConsumer
+{
+public:
+    /** @return true on success */
+    bool init(const std::string &name, size_t slots, size_t max_events);
+
+    void addPulse(uint64_t id, double charge, EventArray tof, EventArray pixel);
+
+    void shutdown();
+
+private:
+    ShmRingWriter ring;
+};
+
+}}
+
+#endif  /* SHMPUBLISHER_H */
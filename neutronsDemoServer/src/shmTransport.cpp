@@ -0,0 +1,215 @@
+/* shmTransport.cpp
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bulkFill.h"
+#include "shmTransport.h"
+
+// Sequence lock and 'written' counter use the GCC atomic builtins,
+// which work on the plain integers in shared memory
+
+namespace epics { namespace neutronServer {
+
+static size_t roundUp(size_t bytes)
+{
+    return (bytes + NS_SHM_ALIGN - 1) / NS_SHM_ALIGN * NS_SHM_ALIGN;
+}
+
+/** @return Address of slot for pulse number n */
+static inline const char *getSlot(const char *memory, const ShmRingHeader *header, uint64_t n)
+{
+    return memory + NS_SHM_ALIGN + (n % header->slots) * header->slot_bytes;
+}
+
+ShmRingWriter::ShmRingWriter()
+: size(0), memory(0), header(0), truncated(0)
+{
+}
+
+ShmRingWriter::~ShmRingWriter()
+{
+    if (memory)
+    {
+        munmap(memory, size);
+        shm_unlink(name.c_str());
+    }
+}
+
+bool ShmRingWriter::create(const std::string &name, size_t slots, size_t max_events)
+{
+    if (slots < 1)
+        slots = 1;
+    size_t slot_bytes = roundUp(NS_SHM_ALIGN + 2 * max_events * sizeof(uint32_t));
+    size = NS_SHM_ALIGN + slots * slot_bytes;
+
+    // Replace segment left over from a previous run
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        std::cout << "Cannot create shared memory '" << name << "': " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (ftruncate(fd, size))
+    {
+        std::cout << "Cannot size shared memory '" << name << "': " << strerror(errno) << std::endl;
+        close(fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+    void *mapped = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        std::cout << "Cannot map shared memory '" << name << "': " << strerror(errno) << std::endl;
+        shm_unlink(name.c_str());
+        return false;
+    }
+    this->name = name;
+    memory = static_cast<char *>(mapped);
+    header = reinterpret_cast<ShmRingHeader *>(memory);
+    header->version = NS_SHM_VERSION;
+    header->slots = slots;
+    header->slot_bytes = slot_bytes;
+    header->max_events = max_events;
+    header->written = 0;
+    // Readers check 'magic' last
+    __atomic_store_n(&header->magic, NS_SHM_MAGIC, __ATOMIC_RELEASE);
+    return true;
+}
+
+void ShmRingWriter::write(uint64_t pulse_id, double charge, const uint32_t *tof, const uint32_t *pixel, size_t count)
+{
+    const uint64_t n = header->written;
+    char *slot_memory = const_cast<char *>(getSlot(memory, header, n));
+    ShmSlotHeader *slot = reinterpret_cast<ShmSlotHeader *>(slot_memory);
+
+    // Mark slot as being written
+    __atomic_store_n(&slot->sequence, 2*n + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->pulse_id = pulse_id;
+    slot->charge = charge;
+    slot->original_events = count;
+    if (count > header->max_events)
+    {
+        count = header->max_events;
+        ++truncated;
+    }
+    slot->events = count;
+    uint32_t *slot_tof = reinterpret_cast<uint32_t *>(slot_memory + NS_SHM_ALIGN);
+    uint32_t *slot_pixel = slot_tof + header->max_events;
+    // Large pulses use streaming stores, no need to keep them in the writer's cache
+    copyEvents(slot_tof, tof, count);
+    copyEvents(slot_pixel, pixel, count);
+
+    // Mark slot as complete, then publish it
+    __atomic_store_n(&slot->sequence, 2*(n + 1), __ATOMIC_RELEASE);
+    __atomic_store_n(&header->written, n + 1, __ATOMIC_RELEASE);
+}
+
+ShmRingReader::ShmRingReader()
+: size(0), memory(0), header(0), next_pulse(0), current(0), current_sequence(0), overruns(0)
+{
+}
+
+ShmRingReader::~ShmRingReader()
+{
+    if (memory)
+        munmap(const_cast<char *>(memory), size);
+}
+
+bool ShmRingReader::open(const std::string &name)
+{
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+    {
+        std::cout << "Cannot open shared memory '" << name << "': " << strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info)  ||  info.st_size < NS_SHM_ALIGN)
+    {
+        std::cout << "Invalid shared memory '" << name << "'" << std::endl;
+        close(fd);
+        return false;
+    }
+    size = info.st_size;
+    void *mapped = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        std::cout << "Cannot map shared memory '" << name << "': " << strerror(errno) << std::endl;
+        return false;
+    }
+    memory = static_cast<const char *>(mapped);
+    header = reinterpret_cast<const ShmRingHeader *>(memory);
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != NS_SHM_MAGIC  ||
+        header->version != NS_SHM_VERSION  ||
+        header->slots < 1  ||
+        NS_SHM_ALIGN + 2 * header->max_events * sizeof(uint32_t) > header->slot_bytes  ||
+        NS_SHM_ALIGN + header->slots * header->slot_bytes > size)
+    {
+        std::cout << "Shared memory '" << name << "' has unknown format" << std::endl;
+        munmap(mapped, size);
+        memory = 0;
+        return false;
+    }
+    // Start with the next pulse
+    next_pulse = __atomic_load_n(&header->written, __ATOMIC_ACQUIRE);
+    return true;
+}
+
+bool ShmRingReader::next(const ShmSlotHeader *&slot, const uint32_t *&tof, const uint32_t *&pixel, size_t &count)
+{
+    while (true)
+    {
+        uint64_t written = __atomic_load_n(&header->written, __ATOMIC_ACQUIRE);
+        if (next_pulse >= written)
+            return false;
+        // Skip pulses that have already been overwritten
+        if (written - next_pulse > header->slots)
+        {
+            overruns += written - header->slots - next_pulse;
+            next_pulse = written - header->slots;
+        }
+        const char *slot_memory = getSlot(memory, header, next_pulse);
+        current = reinterpret_cast<const ShmSlotHeader *>(slot_memory);
+        current_sequence = __atomic_load_n(&current->sequence, __ATOMIC_ACQUIRE);
+        if (current_sequence != 2*(next_pulse + 1))
+        {   // Writer already re-uses the slot
+            ++overruns;
+            ++next_pulse;
+            continue;
+        }
+        ++next_pulse;
+        slot = current;
+        tof = reinterpret_cast<const uint32_t *>(slot_memory + NS_SHM_ALIGN);
+        pixel = tof + header->max_events;
+        count = current->events;
+        if (count > header->max_events)
+            count = header->max_events;
+        return true;
+    }
+}
+
+bool ShmRingReader::isValid()
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&current->sequence, __ATOMIC_RELAXED) == current_sequence)
+        return true;
+    ++overruns;
+    return false;
+}
+
+}} // namespace neutronServer, epics
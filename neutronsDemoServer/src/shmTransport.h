@@ -0,0 +1,149 @@
+/* shmTransport.h
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#ifndef SHMTRANSPORT_H
+#define SHMTRANSPORT_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+
+namespace epics { namespace neutronServer {
+
+#define NS_SHM_NAME    "/neutrons" /** Default name of shared memory segment */
+#define NS_SHM_SLOTS   8           /** Default number of pulses in the ring */
+#define NS_SHM_MAGIC   0x4E53484D  /** 'NSHM' */
+#define NS_SHM_VERSION 1
+#define NS_SHM_ALIGN   64          /** Alignment of ring header, slots and event arrays */
+
+/** Header at the start of the shared memory segment */
+struct ShmRingHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    /** Number of slots in the ring */
+    uint64_t slots;
+    /** Bytes per slot, including ShmSlotHeader */
+    uint64_t slot_bytes;
+    /** Max. number of events per slot */
+    uint64_t max_events;
+    /** Number of pulses written so far. Updated after each pulse */
+    uint64_t written;
+};
+
+/** Header of each slot
+ *
+ *  Time-of-flight values start NS_SHM_ALIGN bytes into the slot,
+ *  pixel IDs follow after 'max_events' time-of-flight values.
+ *
+ *  'sequence' acts as a sequence lock:
+ *  Odd while the writer updates the slot,
+ *  2*(n+1) once pulse number n (counting from 0) is complete.
+ *  Readers check that it has the expected value before and after
+ *  reading the slot, otherwise the writer has overwritten the slot.
+ */
+struct ShmSlotHeader
+{
+    uint64_t sequence;
+    uint64_t pulse_id;
+    double charge;
+    /** Number of events in slot */
+    uint64_t events;
+    /** Number of events in the original pulse, more than 'events' if it did not fit */
+    uint64_t original_events;
+};
+
+/** Writes pulses into a shared memory ring
+ *
+ *  Lock-free, single writer. Readers never block the writer.
+ */
+class ShmRingWriter
+{
+public:
+    ShmRingWriter();
+    ~ShmRingWriter();
+
+    /** Create shared memory segment
+     *  @param name Name for shm_open, starting with '/'
+     *  @param slots Number of pulses in ring
+     *  @param max_events Max. number of events per pulse
+     *  @return true on success
+     */
+    bool create(const std::string &name, size_t slots, size_t max_events);
+
+    /** Write a pulse. Events beyond max_events are dropped */
+    void write(uint64_t pulse_id, double charge, const uint32_t *tof, const uint32_t *pixel, size_t count);
+
+    /** @return Number of pulses that were truncated because they did not fit a slot */
+    uint64_t getTruncated() const
+    {
+        return truncated;
+    }
+
+private:
+    std::string name;
+    size_t size;
+    char *memory;
+    ShmRingHeader *header;
+    uint64_t truncated;
+};
+
+/** Reads pulses from a shared memory ring, in place */
+class ShmRingReader
+{
+public:
+    ShmRingReader();
+    ~ShmRingReader();
+
+    /** Map existing shared memory segment read-only
+     *  @return true on success
+     */
+    bool open(const std::string &name);
+
+    /** Access the next pulse
+     *
+     *  On success, the slot header and event pointers refer to the shared memory.
+     *  After processing the events, call isValid() to check that
+     *  the writer has not overwritten the slot meanwhile.
+     *
+     *  @param count Set to number of events, limited to the slot size
+     *  @return true if there is a new pulse, false if none is available, yet
+     */
+    bool next(const ShmSlotHeader *&slot, const uint32_t *&tof, const uint32_t *&pixel, size_t &count);
+
+    /** @return true if the slot returned by the last next() was not overwritten,
+     *          otherwise counted as overrun
+     */
+    bool isValid();
+
+    /** @return Number of pulses that the reader missed because the writer was ahead by more than the ring size,
+     *          or because it overwrote a slot while it was read
+     */
+    uint64_t getOverruns() const
+    {
+        return overruns;
+    }
+
+    void clearOverruns()
+    {
+        overruns = 0;
+    }
+
+private:
+    size_t size;
+    const char *memory;
+    const ShmRingHeader *header;
+    uint64_t next_pulse;
+    const ShmSlotHeader *current;
+    uint64_t current_sequence;
+    uint64_t overruns;
+};
+
+}}
+
+#endif  /* SHMTRANSPORT_H */
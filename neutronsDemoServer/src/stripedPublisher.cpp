@@ -0,0 +1,90 @@
+/* stripedPublisher.cpp
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#include <algorithm>
+#include <sstream>
+#include <epicsTime.h>
+#include "stripedPublisher.h"
+
+#ifdef USE_PVXS
+     using namespace pvxs;
+#endif
+
+namespace epics { namespace neutronServer {
+
+StripedPublisher::StripedPublisher(const std::string &record_name, size_t stripes)
+: record_name(record_name)
+{
+#ifdef USE_PVXS
+    recordDef = Neutrons{}.build();
+#endif
+    for (size_t i=0; i<stripes; ++i)
+    {
+#ifdef USE_PVXS
+        this->stripes.push_back(server::SharedPV::buildReadonly());
+        this->stripes[i].open(recordDef.create());
+#else
+        this->stripes.push_back(NeutronPVRecord::create(getRecordName(i)));
+#endif
+    }
+}
+
+std::string StripedPublisher::getRecordName(size_t stripe) const
+{
+    std::ostringstream name;
+    name << record_name << ":stripe" << stripe;
+    return name.str();
+}
+
+#ifdef USE_PVXS
+/** @return Copy of array[start, end) */
+static EventArray copySection(const EventArray &array, size_t start, size_t end)
+{
+    shared_array<uint32_t> section(end - start);
+    std::copy(array.begin() + start, array.begin() + end, section.begin());
+    return section.freeze();
+}
+#endif
+
+void StripedPublisher::addPulse(uint64_t id, double charge, EventArray tof, EventArray pixel)
+{
+    size_t count = std::min(tof.size(), pixel.size());
+    size_t n = stripes.size();
+#ifdef USE_PVXS
+    epicsTimeStamp now = epicsTime::getCurrent();
+#endif
+    for (size_t i=0; i<n; ++i)
+    {
+        size_t start = count * i / n, end = count * (i+1) / n;
+        double stripe_charge = i == 0 ? charge : 0.0;
+#ifdef USE_PVXS
+        // shared_array has no slice(), so each stripe is a copy
+        Value update = recordDef.create();
+        update["timeStamp.secondsPastEpoch"] = now.secPastEpoch;
+        update["timeStamp.nanoseconds"] = now.nsec;
+        update["timeStamp.userTag"] = id;
+        update["proton_charge.value"] = stripe_charge;
+        update["time_of_flight.value"] = copySection(tof, start, end);
+        update["pixel.value"] = copySection(pixel, start, end);
+        stripes[i].post(std::move(update));
+#else
+        // Slices share the frozen arrays, no copy
+        EventArray tof_section(tof), pixel_section(pixel);
+        tof_section.slice(start, end - start);
+        pixel_section.slice(start, end - start);
+        stripes[i]->update(id, stripe_charge, tof_section, pixel_section);
+#endif
+    }
+}
+
+void StripedPublisher::shutdown()
+{
+    // Nothing to stop, stripes are posted by the event generator thread
+}
+
+}} // namespace neutronServer, epics
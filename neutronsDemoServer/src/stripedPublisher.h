@@ -0,0 +1,69 @@
+/* stripedPublisher.h
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#ifndef STRIPEDPUBLISHER_H
+#define STRIPEDPUBLISHER_H
+
+#include <string>
+#include <vector>
+
+#include "neutronServer.h"
+
+namespace epics { namespace neutronServer {
+
+/** Publishes each pulse split into stripes
+ *
+ *  Stripe k of K is published as 'record_name:stripe<k>'
+ *  with the same structure as the complete pulse,
+ *  holding events [k*N/K, (k+1)*N/K) of the N events in the pulse.
+ *  All stripes carry the pulse ID in timeStamp.userTag,
+ *  so clients can reassemble the pulse.
+ *  The proton charge is only in stripe 0, the other stripes have 0.
+ */
+class StripedPublisher : public PulseConsumer
+{
+public:
+    StripedPublisher(const std::string &record_name, size_t stripes);
+
+    void addPulse(uint64_t id, double charge, EventArray tof, EventArray pixel);
+
+    void shutdown();
+
+    size_t getStripeCount() const
+    {
+        return stripes.size();
+    }
+
+    /** @return Name of stripe's record */
+    std::string getRecordName(size_t stripe) const;
+
+#ifdef USE_PVXS
+    pvxs::server::SharedPV& getRecord(size_t stripe)
+    {
+        return stripes[stripe];
+    }
+#else
+    NeutronPVRecord::shared_pointer getRecord(size_t stripe)
+    {
+        return stripes[stripe];
+    }
+#endif
+
+private:
+    std::string record_name;
+#ifdef USE_PVXS
+    std::vector<pvxs::server::SharedPV> stripes;
+    pvxs::TypeDef recordDef;
+#else
+    std::vector<NeutronPVRecord::shared_pointer> stripes;
+#endif
+};
+
+}}
+
+#endif  /* STRIPEDPUBLISHER_H */
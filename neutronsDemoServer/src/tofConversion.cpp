@@ -0,0 +1,263 @@
+/* tofConversion.cpp
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <epicsTime.h>
+#include "tofConversion.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#    include <immintrin.h>
+#    define NS_HAVE_AVX2_KERNEL
+#endif
+
+#ifdef USE_PVXS
+#    include <pvxs/nt.h>
+     using namespace pvxs;
+#else
+#   include <pv/standardPVField.h>
+     using namespace epics::pvData;
+     using namespace epics::pvDatabase;
+     using namespace std;
+#endif
+
+namespace epics { namespace neutronServer {
+
+bool TOFCalibration::set(uint32_t pixel, double flight_path, double two_theta, Kind kind)
+{
+    if (pixel > NS_ID_MAX2)
+        return false;
+    // Keep one extra '0' factor at the end for unknown pixels
+    const size_t size = static_cast<size_t>(pixel) + 2;
+    if (size > factors.size())
+        factors.resize(size, 0.0f);
+    double factor = NS_WAVELENGTH_PER_US_M * NS_TOF_UNIT_US / flight_path;
+    if (kind == D_SPACING)
+        factor /= 2.0 * sin(two_theta * M_PI / 360.0);
+    factors[pixel] = static_cast<float>(factor);
+    return true;
+}
+
+bool TOFCalibration::load(const std::string &filename, Kind kind)
+{
+    std::ifstream file(filename.c_str());
+    if (! file)
+    {
+        std::cout << "Cannot open calibration file '" << filename << "'" << std::endl;
+        return false;
+    }
+    factors.clear();
+    std::string line;
+    size_t line_no = 0;
+    while (std::getline(file, line))
+    {
+        ++line_no;
+        size_t comment = line.find('#');
+        if (comment != std::string::npos)
+            line.erase(comment);
+        std::istringstream items(line);
+        uint32_t pixel;
+        double flight_path, two_theta;
+        if (! (items >> pixel))
+            continue; // Empty line
+        if (! (items >> flight_path >> two_theta)  ||  flight_path <= 0)
+        {
+            std::cout << filename << ":" << line_no << ": Expected 'pixel flight_path_m two_theta_deg'" << std::endl;
+            return false;
+        }
+        if (! set(pixel, flight_path, two_theta, kind))
+        {
+            std::cout << filename << ":" << line_no << ": Pixel ID " << pixel << " is beyond " << NS_ID_MAX2 << std::endl;
+            return false;
+        }
+    }
+    if (factors.empty())
+    {
+        std::cout << "No pixels in calibration file '" << filename << "'" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void TOFCalibration::createDemo(Kind kind)
+{
+    // 20m moderator to sample,
+    // bank 1 at 2m, 90 degrees, bank 2 at 3m, 150 degrees
+    factors.clear();
+    for (uint32_t pixel=NS_ID_MIN1; pixel<=NS_ID_MAX1; ++pixel)
+        set(pixel, 22.0, 90.0, kind);
+    for (uint32_t pixel=NS_ID_MIN2; pixel<=NS_ID_MAX2; ++pixel)
+        set(pixel, 23.0, 150.0, kind);
+}
+
+
+static void convertEventsScalar(const uint32_t *tof, const uint32_t *pixel, size_t count,
+                                const float *factor, size_t factor_count, float *out)
+{
+    const uint32_t last = factor_count - 1;
+    for (size_t i=0; i<count; ++i)
+        out[i] = tof[i] * factor[std::min(pixel[i], last)];
+}
+
+#ifdef NS_HAVE_AVX2_KERNEL
+/** Gather factors for 8 pixels at a time.
+ *  TOF is converted as signed int32, which is fine below 2^31.
+ */
+__attribute__((target("avx2")))
+static void convertEventsAVX2(const uint32_t *tof, const uint32_t *pixel, size_t count,
+                              const float *factor, size_t factor_count, float *out)
+{
+    const __m256i last = _mm256_set1_epi32(factor_count - 1);
+    size_t i = 0;
+    for (/**/; i+8 <= count; i += 8)
+    {
+        __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pixel + i));
+        p = _mm256_min_epu32(p, last);
+        __m256 f = _mm256_i32gather_ps(factor, p, 4);
+        __m256 t = _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(tof + i)));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(t, f));
+    }
+    convertEventsScalar(tof + i, pixel + i, count - i, factor, factor_count, out + i);
+}
+#endif
+
+void convertEvents(const uint32_t *tof, const uint32_t *pixel, size_t count,
+                   const float *factor, size_t factor_count, float *out)
+{
+#ifdef NS_HAVE_AVX2_KERNEL
+    static const bool have_avx2 = __builtin_cpu_supports("avx2");
+    if (have_avx2)
+    {
+        convertEventsAVX2(tof, pixel, count, factor, factor_count, out);
+        return;
+    }
+#endif
+    convertEventsScalar(tof, pixel, count, factor, factor_count, out);
+}
+
+
+#ifndef USE_PVXS
+ConvertedPVRecord::shared_pointer ConvertedPVRecord::create(string const & recordName)
+{
+    PVStructurePtr pvStructure = getPVDataCreate()->createPVStructure(
+        getStandardField()->scalarArray(pvFloat, "timeStamp"));
+    ConvertedPVRecord::shared_pointer pvRecord(new ConvertedPVRecord(recordName, pvStructure));
+    if (!pvRecord->init())
+        pvRecord.reset();
+    return pvRecord;
+}
+
+ConvertedPVRecord::ConvertedPVRecord(string const & recordName, PVStructurePtr const & pvStructure)
+: PVRecord(recordName, pvStructure), pulse_id(0)
+{
+}
+
+bool ConvertedPVRecord::init()
+{
+    initPVRecord();
+
+    if (!pvTimeStamp.attach(getPVStructure()->getSubField("timeStamp")))
+        return false;
+
+    pvValue = getPVStructure()->getSubField<PVFloatArray>("value");
+    if (pvValue.get() == NULL)
+        return false;
+
+    return true;
+}
+
+void ConvertedPVRecord::process()
+{
+    timeStamp.getCurrent();
+    timeStamp.setUserTag(static_cast<int>(pulse_id));
+    pvTimeStamp.set(timeStamp);
+}
+
+void ConvertedPVRecord::update(uint64 id, shared_vector<const float> value)
+{
+    lock();
+    try
+    {
+        beginGroupPut();
+        pulse_id = id;
+        pvValue->replace(value);
+        process();
+        endGroupPut();
+    }
+    catch(...)
+    {
+        unlock();
+        throw;
+    }
+    unlock();
+}
+#endif // USE_PVXS
+
+
+TOFConversion::TOFConversion(const std::string &record_name, const TOFCalibration &calibration)
+: factors(calibration.getFactors()), pool(WorkPool::getDefault())
+{
+    if (factors.empty())
+        factors.push_back(0.0f);
+#ifdef USE_PVXS
+    record = server::SharedPV::buildReadonly();
+    prototype = nt::NTScalar{TypeCode::Float32A}.create();
+    record.open(prototype);
+#else
+    record = ConvertedPVRecord::create(record_name);
+#endif
+}
+
+TOFConversion::~TOFConversion()
+{
+    shutdown();
+}
+
+void TOFConversion::addPulse(uint64_t id, double charge, EventArray tof, EventArray pixel)
+{
+    const size_t count = std::min(tof.size(), pixel.size());
+#ifdef USE_PVXS
+    shared_array<float> result(count);
+#else
+    shared_vector<float> result(count);
+#endif
+    float *out = result.data();
+
+    // Pool tasks convert sections of the pulse,
+    // arrays stay valid since parallelFor returns when all are done
+    const uint32_t *tof_data = tof.data(), *pixel_data = pixel.data();
+    const float *factor = &factors[0];
+    const size_t factor_count = factors.size();
+    pool.parallelFor(0, count, NS_CONVERSION_GRAIN,
+                     [tof_data, pixel_data, factor, factor_count, out](size_t start, size_t end)
+    {
+        convertEvents(tof_data + start, pixel_data + start, end - start,
+                      factor, factor_count, out + start);
+    });
+
+#ifdef USE_PVXS
+    Value update = prototype.cloneEmpty();
+    epicsTimeStamp now = epicsTime::getCurrent();
+    update["timeStamp.secondsPastEpoch"] = now.secPastEpoch;
+    update["timeStamp.nanoseconds"] = now.nsec;
+    update["timeStamp.userTag"] = id;
+    update["value"] = result.freeze();
+    record.post(std::move(update));
+#else
+    record->update(id, freeze(result));
+#endif
+}
+
+void TOFConversion::shutdown()
+{   // Nothing to stop, the pool is shared
+}
+
+}} // namespace neutronServer, epics
@@ -0,0 +1,139 @@
+/* tofConversion.h
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#ifndef TOFCONVERSION_H
+#define TOFCONVERSION_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <workerRunnable.h>
+
+#include "neutronServer.h"
+
+#ifdef USE_PVXS
+#    include <pvxs/data.h>
+#    include <pvxs/sharedpv.h>
+#else
+#    include <pv/pvDatabase.h>
+#    include <pv/timeStamp.h>
+#    include <pv/pvTimeStamp.h>
+#endif
+
+namespace epics { namespace neutronServer {
+
+#define NS_TOF_UNIT_US         0.1          /** Time-of-flight unit in microseconds */
+#define NS_WAVELENGTH_PER_US_M 0.0039560346 /** h/m_n in Angstrom*m/us: lambda = 0.0039560346 * t[us] / L[m] */
+#define NS_CONVERSION_GRAIN    65536        /** Max. number of events converted by one WorkPool task */
+
+/** Per-pixel calibration: Multiply TOF by factor[pixel] */
+class TOFCalibration
+{
+public:
+    enum Kind { WAVELENGTH, D_SPACING };
+
+    /** Load calibration file
+     *
+     *  Each line lists "pixel  flight_path_m  two_theta_deg",
+     *  '#' starts a comment.
+     *  Pixels that are not listed convert to 0.
+     *
+     *  @return true on success
+     */
+    bool load(const std::string &filename, Kind kind);
+
+    /** Create calibration for the demo detector banks */
+    void createDemo(Kind kind);
+
+    /** @return Factors, padded with a final 0 for pixel IDs beyond the table */
+    const std::vector<float>& getFactors() const
+    {
+        return factors;
+    }
+
+private:
+    /** @return false for pixel IDs beyond the detector, NS_ID_MAX2 */
+    bool set(uint32_t pixel, double flight_path, double two_theta, Kind kind);
+
+    std::vector<float> factors;
+};
+
+/** Convert events: out[i] = tof[i] * factor[min(pixel[i], factor_count-1)]
+ *
+ *  Uses an AVX2 gather when the CPU supports it.
+ *  Last factor must be 0 so that unknown pixel IDs convert to 0.
+ */
+void convertEvents(const uint32_t *tof, const uint32_t *pixel, size_t count,
+                   const float *factor, size_t factor_count, float *out);
+
+#ifndef USE_PVXS
+/** Record with timeStamp and float[] value of converted events */
+class ConvertedPVRecord : public epics::pvDatabase::PVRecord
+{
+public:
+    POINTER_DEFINITIONS(ConvertedPVRecord);
+
+    static ConvertedPVRecord::shared_pointer create(std::string const & recordName);
+    virtual bool init();
+    virtual void process();
+
+    /** Update the values of the record */
+    void update(epics::pvData::uint64 id, epics::pvData::shared_vector<const float> value);
+
+private:
+    ConvertedPVRecord(std::string const & recordName,
+                      epics::pvData::PVStructurePtr const & pvStructure);
+
+    epics::pvData::TimeStamp       timeStamp;
+    epics::pvData::uint32          pulse_id;
+    epics::pvData::PVTimeStamp     pvTimeStamp;
+    epics::pvData::PVFloatArrayPtr pvValue;
+};
+#endif // USE_PVXS
+
+/** Converts time-of-flight of each pulse into wavelength or d-spacing,
+ *  publishing a derived record with the same pulse ID.
+ *
+ *  Sections of the pulse are converted in parallel on the shared WorkPool.
+ */
+class TOFConversion : public PulseConsumer
+{
+public:
+    TOFConversion(const std::string &record_name, const TOFCalibration &calibration);
+    ~TOFConversion();
+
+    void addPulse(uint64_t id, double charge, EventArray tof, EventArray pixel);
+
+    void shutdown();
+
+#ifdef USE_PVXS
+    pvxs::server::SharedPV& getRecord()
+    {
+        return record;
+    }
+#else
+    ConvertedPVRecord::shared_pointer getRecord()
+    {
+        return record;
+    }
+#endif
+
+private:
+#ifdef USE_PVXS
+    pvxs::server::SharedPV record;
+    pvxs::Value prototype;
+#else
+    ConvertedPVRecord::shared_pointer record;
+#endif
+    std::vector<float> factors;
+    WorkPool &pool;
+};
+
+}}
+
+#endif  /* TOFCONVERSION_H */
@@ -0,0 +1,121 @@
+/* udpPublisher.cpp
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <sys/uio.h>
+#include <epicsGuard.h>
+#include "udpPublisher.h"
+
+namespace epics { namespace neutronServer {
+
+UDPPublisher::UDPPublisher(size_t datagram_size)
+: datagram_size(std::max(std::min(datagram_size, (size_t)NS_UDP_MAX_DATAGRAM),
+                         sizeof(UDPHeader) + 2*sizeof(uint32_t))),
+  sock(INVALID_SOCKET), busy(false), sequence(0), dropped(0), send_errors(0), id(0), charge(0.0)
+{
+}
+
+UDPPublisher::~UDPPublisher()
+{
+    if (sock != INVALID_SOCKET)
+        epicsSocketDestroy(sock);
+}
+
+bool UDPPublisher::init(const std::string &address)
+{
+    if (! parseUDPAddress(address, this->address))
+        return false;
+    sock = createUDPSender(this->address);
+    if (sock == INVALID_SOCKET)
+        return false;
+    thread.reset(new epicsThread(*this, "udp_sender", epicsThreadGetStackSize(epicsThreadStackMedium)));
+    thread->start();
+    return true;
+}
+
+void UDPPublisher::addPulse(uint64_t id, double charge, EventArray tof, EventArray pixel)
+{
+    {
+        epicsGuard<epicsMutex> guard(mutex);
+        if (busy)
+        {   // Don't delay the event generator
+            ++dropped;
+            return;
+        }
+        busy = true;
+    }
+    this->id = id;
+    this->charge = charge;
+    this->tof = tof;
+    this->pixel = pixel;
+    startWork();
+}
+
+void UDPPublisher::doWork()
+{
+    const size_t count = std::min(tof.size(), pixel.size());
+    const size_t per_datagram = (datagram_size - sizeof(UDPHeader)) / (2*sizeof(uint32_t));
+    const size_t fragments = std::max((size_t)1, (count + per_datagram - 1) / per_datagram);
+
+    UDPHeader header;
+    header.magic = NS_UDP_MAGIC;
+    header.pulse_id = id;
+    header.charge = charge;
+    header.event_count = count;
+    header.fragments = fragments;
+    header.reserved = 0;
+
+    // Send header and sections of both arrays without copying them
+    struct iovec parts[3];
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_name = &address.sa;
+    message.msg_namelen = sizeof(address.ia);
+    message.msg_iov = parts;
+    message.msg_iovlen = 3;
+    parts[0].iov_base = &header;
+    parts[0].iov_len = sizeof(header);
+
+    for (size_t i=0; i<fragments; ++i)
+    {
+        size_t first = i * per_datagram;
+        size_t events = std::min(per_datagram, count - first);
+        header.sequence = sequence++;
+        header.first_event = first;
+        header.events = events;
+        header.fragment = i;
+        parts[1].iov_base = const_cast<uint32_t *>(tof.data() + first);
+        parts[1].iov_len = events * sizeof(uint32_t);
+        parts[2].iov_base = const_cast<uint32_t *>(pixel.data() + first);
+        parts[2].iov_len = events * sizeof(uint32_t);
+        // Loss is detected by receivers, sender keeps going
+        if (sendmsg(sock, &message, 0) < 0)
+            ++send_errors;
+    }
+
+    // Release arrays
+    tof = EventArray();
+    pixel = EventArray();
+
+    epicsGuard<epicsMutex> guard(mutex);
+    busy = false;
+}
+
+void UDPPublisher::shutdown()
+{
+    if (thread)
+        WorkerRunnable::shutdown();
+    if (dropped > 0)
+        std::cout << "UDP publisher dropped " << dropped << " pulses" << std::endl;
+    if (send_errors > 0)
+        std::cout << "UDP publisher failed to send " << send_errors << " datagrams" << std::endl;
+}
+
+}} // namespace neutronServer, epics
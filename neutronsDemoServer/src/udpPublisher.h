@@ -0,0 +1,72 @@
+/* udpPublisher.h
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#ifndef UDPPUBLISHER_H
+#define UDPPUBLISHER_H
+
+#include <memory>
+#include <string>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+#include <workerRunnable.h>
+
+#include "neutronServer.h"
+#include "udpTransport.h"
+
+namespace epics { namespace neutronServer {
+
+/** Sends each pulse as UDP datagrams, multicast or to a single address
+ *
+ *  Pulses are split into fragments of at most 'datagram_size' bytes,
+ *  see UDPHeader.
+ *  Events are sent directly from the frozen arrays, no copy.
+ *  With multicast, the cost per pulse does not depend on the number of receivers.
+ *
+ *  Datagrams are sent by a separate thread.
+ *  If that thread is still busy with the previous pulse,
+ *  the new pulse is dropped so that the event generator is not delayed.
+ */
+class UDPPublisher : public PulseConsumer, public WorkerRunnable
+{
+public:
+    UDPPublisher(size_t datagram_size = NS_UDP_DATAGRAM_SIZE);
+    ~UDPPublisher();
+
+    /** Open socket and start thread
+     *  @param address "host:port", multicast or unicast
+     *  @return true on success
+     */
+    bool init(const std::string &address);
+
+    void addPulse(uint64_t id, double charge, EventArray tof, EventArray pixel);
+
+    void shutdown();
+
+protected:
+    void doWork();
+
+private:
+    size_t datagram_size;
+    SOCKET sock;
+    osiSockAddr address;
+    std::shared_ptr<epicsThread> thread;
+    epicsMutex mutex;
+    bool busy;
+    uint32_t sequence;
+    size_t dropped;
+    size_t send_errors;
+
+    // Pulse handled by thread
+    uint64_t id;
+    double charge;
+    EventArray tof, pixel;
+};
+
+}}
+
+#endif  /* UDPPUBLISHER_H */
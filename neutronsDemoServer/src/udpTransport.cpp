@@ -0,0 +1,204 @@
+/* udpTransport.cpp
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include "udpTransport.h"
+
+namespace epics { namespace neutronServer {
+
+bool parseUDPAddress(const std::string &spec, osiSockAddr &address)
+{
+    memset(&address, 0, sizeof(address));
+    if (aToIPAddr(spec.c_str(), NS_UDP_PORT, &address.ia) != 0)
+    {
+        std::cout << "Invalid UDP address '" << spec << "'" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool isMulticast(const osiSockAddr &address)
+{
+    return IN_MULTICAST(ntohl(address.ia.sin_addr.s_addr));
+}
+
+/** Show error for socket operation */
+static void socketError(const char *what)
+{
+    char message[100];
+    epicsSocketConvertErrnoToString(message, sizeof(message));
+    std::cout << "UDP " << what << ": " << message << std::endl;
+}
+
+SOCKET createUDPSender(const osiSockAddr &address)
+{
+    SOCKET sock = epicsSocketCreate(AF_INET, SOCK_DGRAM, 0);
+    if (sock == INVALID_SOCKET)
+    {
+        socketError("socket");
+        return INVALID_SOCKET;
+    }
+    int size = NS_UDP_BUFFER_SIZE;
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (char *)&size, sizeof(size));
+    if (isMulticast(address))
+    {   // Stay on local subnet, include listeners on this host
+        unsigned char ttl = 1, loop = 1;
+        if (setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, (char *)&ttl, sizeof(ttl))  ||
+            setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, (char *)&loop, sizeof(loop)))
+        {
+            socketError("multicast setup");
+            epicsSocketDestroy(sock);
+            return INVALID_SOCKET;
+        }
+    }
+    return sock;
+}
+
+SOCKET createUDPReceiver(const osiSockAddr &address)
+{
+    SOCKET sock = epicsSocketCreate(AF_INET, SOCK_DGRAM, 0);
+    if (sock == INVALID_SOCKET)
+    {
+        socketError("socket");
+        return INVALID_SOCKET;
+    }
+    // Allow several receivers on this host
+    epicsSocketEnableAddressUseForDatagramFanout(sock);
+    int size = NS_UDP_BUFFER_SIZE;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (char *)&size, sizeof(size));
+
+    osiSockAddr local;
+    memset(&local, 0, sizeof(local));
+    local.ia.sin_family = AF_INET;
+    local.ia.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.ia.sin_port = address.ia.sin_port;
+    if (bind(sock, &local.sa, sizeof(local.ia)))
+    {
+        socketError("bind");
+        epicsSocketDestroy(sock);
+        return INVALID_SOCKET;
+    }
+    if (isMulticast(address))
+    {
+        struct ip_mreq group;
+        memset(&group, 0, sizeof(group));
+        group.imr_multiaddr = address.ia.sin_addr;
+        group.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char *)&group, sizeof(group)))
+        {
+            socketError("multicast join");
+            epicsSocketDestroy(sock);
+            return INVALID_SOCKET;
+        }
+    }
+    return sock;
+}
+
+UDPReassembler::UDPReassembler()
+: have_sequence(false), next_sequence(0), pulse_id(0), charge(0.0)
+{
+    clearStats();
+}
+
+void UDPReassembler::clearStats()
+{
+    datagrams = lost = reordered = invalid = complete = incomplete = 0;
+}
+
+bool UDPReassembler::add(const char *datagram, size_t size)
+{
+    UDPHeader header;
+    if (size < sizeof(header))
+    {
+        ++invalid;
+        return false;
+    }
+    memcpy(&header, datagram, sizeof(header));
+    if (header.magic != NS_UDP_MAGIC  ||
+        size != sizeof(header) + 2 * sizeof(uint32_t) * header.events  ||
+        header.fragment >= header.fragments  ||
+        header.event_count > NS_UDP_MAX_EVENTS  ||
+        // Each fragment carries at least one event, except for an empty pulse
+        header.fragments > std::max(header.event_count, (uint32_t)1)  ||
+        static_cast<uint64_t>(header.first_event) + header.events > header.event_count  ||
+        header.event_count > static_cast<uint64_t>(header.fragments) * (NS_UDP_MAX_DATAGRAM / (2*sizeof(uint32_t))))
+    {
+        ++invalid;
+        return false;
+    }
+    ++datagrams;
+
+    // Sequence numbers detect lost datagrams.
+    // A 'lost' datagram that arrives late was reordered.
+    if (have_sequence)
+    {
+        int32_t diff = static_cast<int32_t>(header.sequence - next_sequence);
+        if (diff > 0)
+            lost += diff;
+        else if (diff < 0)
+        {
+            ++reordered;
+            if (lost > 0)
+                --lost;
+        }
+    }
+    if (! have_sequence  ||  static_cast<int32_t>(header.sequence - next_sequence) >= 0)
+    {
+        next_sequence = header.sequence + 1;
+        have_sequence = true;
+    }
+
+    std::map<uint64_t, Pulse>::iterator found = pending.find(header.pulse_id);
+    if (found == pending.end())
+    {   // Drop pulses that are unlikely to ever complete, bound the number of pulses
+        while (! pending.empty()  &&
+               (pending.size() >= NS_UDP_PENDING  ||  pending.begin()->first + NS_UDP_PENDING < header.pulse_id))
+        {
+            pending.erase(pending.begin());
+            ++incomplete;
+        }
+        found = pending.insert(std::make_pair(header.pulse_id, Pulse())).first;
+    }
+    Pulse &pulse = found->second;
+    if (pulse.have.empty())
+    {
+        pulse.received = 0;
+        pulse.have.resize(header.fragments, false);
+        pulse.tof.resize(header.event_count);
+        pulse.pixel.resize(header.event_count);
+    }
+    if (pulse.have.size() != header.fragments  ||  pulse.tof.size() != header.event_count)
+    {   // Inconsistent with earlier fragments of this pulse
+        ++invalid;
+        return false;
+    }
+    if (pulse.have[header.fragment])
+        return false; // Duplicate
+    pulse.have[header.fragment] = true;
+    if (header.events > 0)
+    {
+        const char *events = datagram + sizeof(header);
+        memcpy(&pulse.tof[header.first_event], events, header.events * sizeof(uint32_t));
+        memcpy(&pulse.pixel[header.first_event], events + header.events * sizeof(uint32_t), header.events * sizeof(uint32_t));
+    }
+    if (++pulse.received < header.fragments)
+        return false;
+
+    // Pulse is complete
+    pulse_id = header.pulse_id;
+    charge = header.charge;
+    tof.swap(pulse.tof);
+    pixel.swap(pulse.pixel);
+    pending.erase(found);
+    ++complete;
+    return true;
+}
+
+}} // namespace neutronServer, epics
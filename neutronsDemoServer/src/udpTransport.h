@@ -0,0 +1,131 @@
+/* udpTransport.h
+ *
+ * Copyright (c) 2014 Oak Ridge National Laboratory.
+ * All rights reserved.
+ * See file LICENSE that is included with this distribution.
+ *
+ * @author Kay Kasemir
+ */
+#ifndef UDPTRANSPORT_H
+#define UDPTRANSPORT_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+#include <osiSock.h>
+
+namespace epics { namespace neutronServer {
+
+#define NS_UDP_PORT          5078       /** Default UDP port */
+#define NS_UDP_MAGIC         0x4E455554 /** 'NEUT', also detects byte order mismatch */
+#define NS_UDP_DATAGRAM_SIZE 1472       /** Default datagram size, fits 1500 byte Ethernet MTU */
+#define NS_UDP_MAX_DATAGRAM  65507      /** Max. UDP payload */
+#define NS_UDP_PENDING       100        /** Number of pulses that may wait for missing fragments */
+#define NS_UDP_MAX_EVENTS    10000000   /** Max. events per pulse accepted by the receiver */
+#define NS_UDP_BUFFER_SIZE   (8*1024*1024) /** Socket send/receive buffer size */
+
+/** Header of each datagram
+ *
+ *  Followed by 'events' time-of-flight values,
+ *  then 'events' pixel IDs, all in host byte order.
+ */
+struct UDPHeader
+{
+    /** NS_UDP_MAGIC */
+    uint32_t magic;
+    /** Datagram sequence number, increments for each datagram sent */
+    uint32_t sequence;
+    /** Pulse ID */
+    uint64_t pulse_id;
+    /** Proton charge of the pulse */
+    double charge;
+    /** Number of events in the complete pulse */
+    uint32_t event_count;
+    /** Index of first event in this datagram */
+    uint32_t first_event;
+    /** Number of events in this datagram */
+    uint32_t events;
+    /** Fragment index 0 .. fragments-1 */
+    uint32_t fragment;
+    /** Number of fragments for this pulse */
+    uint32_t fragments;
+    /** Keeps the events 8-byte aligned */
+    uint32_t reserved;
+};
+
+/** Parse "host:port" into address, using NS_UDP_PORT if port is omitted
+ *  @return true on success
+ */
+bool parseUDPAddress(const std::string &spec, osiSockAddr &address);
+
+/** @return true for multicast address */
+bool isMulticast(const osiSockAddr &address);
+
+/** Create socket for sending to address, configured for multicast if necessary
+ *  @return INVALID_SOCKET on error
+ */
+SOCKET createUDPSender(const osiSockAddr &address);
+
+/** Create socket for receiving on the port of address, joining multicast group if necessary
+ *  @return INVALID_SOCKET on error
+ */
+SOCKET createUDPReceiver(const osiSockAddr &address);
+
+/** Reassembles pulses from received datagrams
+ *
+ *  Tracks lost and reordered datagrams via their sequence numbers.
+ *  Pulses that are still missing fragments when a pulse
+ *  NS_UDP_PENDING IDs newer arrives are dropped as incomplete,
+ *  and at most NS_UDP_PENDING pulses are kept.
+ *  Pulses of more than NS_UDP_MAX_EVENTS are rejected as invalid.
+ */
+class UDPReassembler
+{
+public:
+    UDPReassembler();
+
+    /** Handle received datagram
+     *  @return true when it completed a pulse
+     */
+    bool add(const char *datagram, size_t size);
+
+    /** Most recently completed pulse */
+    uint64_t getPulseID() const              { return pulse_id; }
+    double getCharge() const                 { return charge; }
+    const std::vector<uint32_t> &getTOF() const   { return tof; }
+    const std::vector<uint32_t> &getPixel() const { return pixel; }
+
+    uint64_t getDatagrams() const  { return datagrams; }
+    uint64_t getLost() const       { return lost; }
+    uint64_t getReordered() const  { return reordered; }
+    uint64_t getInvalid() const    { return invalid; }
+    uint64_t getComplete() const   { return complete; }
+    uint64_t getIncomplete() const { return incomplete; }
+
+    /** Reset the statistics, not the pulses in progress */
+    void clearStats();
+
+private:
+    struct Pulse
+    {
+        size_t received;
+        std::vector<bool> have;
+        std::vector<uint32_t> tof, pixel;
+    };
+
+    bool have_sequence;
+    uint32_t next_sequence;
+    std::map<uint64_t, Pulse> pending;
+
+    uint64_t pulse_id;
+    double charge;
+    std::vector<uint32_t> tof, pixel;
+
+    uint64_t datagrams, lost, reordered, invalid, complete, incomplete;
+};
+
+}}
+
+#endif  /* UDPTRANSPORT_H */
@@ -6,22 +6,118 @@
  *
  * @author Kay Kasemir
  */
+#include <iostream>
+#include <epicsGuard.h>
 #include <workerRunnable.h>
 
 namespace epics { namespace neutronServer {
 
+bool WorkItem::isDone()
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    return done;
+}
+
+void WorkItem::wait()
+{
+    while (! isDone())
+        completed.wait();
+    // Pass the signal on to other waiting threads
+    completed.signal();
+}
+
+std::exception_ptr WorkItem::getError()
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    return error;
+}
+
+void WorkItem::then(std::function<void ()> continuation)
+{
+    {
+        epicsGuard<epicsMutex> guard(mutex);
+        if (! done)
+        {
+            continuations.push_back(continuation);
+            return;
+        }
+    }
+    continuation();
+}
+
+void WorkItem::execute()
+{
+    std::exception_ptr error;
+    try
+    {
+        work();
+    }
+    catch (...)
+    {   // Keep the thread, report to get()
+        error = std::current_exception();
+    }
+    // Release what the work holds, for example a pulse
+    work = std::function<void ()>();
+    if (error)
+    {
+        epicsGuard<epicsMutex> guard(mutex);
+        this->error = error;
+    }
+    complete();
+}
+
+void WorkItem::complete()
+{
+    std::vector<std::function<void ()> > continuations;
+    {
+        epicsGuard<epicsMutex> guard(mutex);
+        done = true;
+        continuations.swap(this->continuations);
+    }
+    completed.signal();
+    for (size_t i=0; i<continuations.size(); ++i)
+        continuations[i]();
+}
+
+
 void WorkerRunnable::run()
 {
     while (do_run)
     {
-        if (! new_work.wait(0.5))
-            continue; // check is_running, wait again
+        std::shared_ptr<WorkItem> item;
+        {
+            epicsGuard<epicsMutex> guard(mutex);
+            if (! queue.empty())
+            {
+                item = queue.front();
+                queue.pop_front();
+            }
+        }
+        if (! item)
+        {   // Check do_run at least every 0.5 seconds
+            new_work.wait(0.5);
+            continue;
+        }
 
-        doWork();
+        item->execute();
+        {
+            epicsGuard<epicsMutex> guard(mutex);
+            --outstanding;
+        }
+        space_available.signal();
+    }
 
-        // Signal that we're done
-        work_completed.signal();
+    // Complete items that will not be executed, so nobody waits for them
+    std::deque<std::shared_ptr<WorkItem> > remaining;
+    {
+        epicsGuard<epicsMutex> guard(mutex);
+        remaining.swap(queue);
+        outstanding = 0;
+        stopped = true;
     }
+    for (size_t i=0; i<remaining.size(); ++i)
+        remaining[i]->complete();
+    space_available.signal();
     thread_exited.signal();
 }
 
@@ -32,4 +128,269 @@ void WorkerRunnable::shutdown()
     thread_exited.wait(5.0);
 }
 
+void WorkerRunnable::setMaxOutstanding(size_t max_outstanding)
+{
+    epicsGuard<epicsMutex> guard(mutex);
+    this->max_outstanding = max_outstanding > 0 ? max_outstanding : 1;
+}
+
+std::shared_ptr<WorkItem> WorkerRunnable::submit(std::function<void ()> work)
+{
+    std::shared_ptr<WorkItem> item(new WorkItem(work));
+    while (true)
+    {
+        {
+            epicsGuard<epicsMutex> guard(mutex);
+            if (stopped)
+                break;
+            if (outstanding < max_outstanding)
+            {
+                ++outstanding;
+                queue.push_back(item);
+                new_work.signal();
+                return item;
+            }
+        }
+        // Wait for an item to complete
+        space_available.wait(0.5);
+    }
+    // Thread has exited, nobody will execute the item
+    item->complete();
+    return item;
+}
+
+/** Runs the thread loop of one WorkPool thread */
+class WorkPool::Worker : public epicsThreadRunable
+{
+public:
+    Worker(WorkPool &pool, size_t index)
+    : pool(pool), index(index)
+    {}
+
+    void run()
+    {
+        pool.work(index);
+        thread_exited.signal();
+    }
+
+    /** Signaled when run() returns */
+    epicsEvent thread_exited;
+
+private:
+    WorkPool &pool;
+    size_t index;
+};
+
+/** Pool and index of the calling thread, if it's a pool thread */
+static thread_local const WorkPool *current_pool = 0;
+static thread_local size_t current_index = 0;
+
+WorkPool::WorkPool(size_t threads, const char *name)
+: do_run(true), pending(0), next_queue(0)
+{
+    if (threads < 1)
+        threads = 1;
+    for (size_t i=0; i<threads; ++i)
+        queues.push_back(std::shared_ptr<Queue>(new Queue()));
+    // Start threads once all deques exist, since threads steal from all of them
+    for (size_t i=0; i<threads; ++i)
+    {
+        std::shared_ptr<Worker> worker(new Worker(*this, i));
+        std::shared_ptr<epicsThread> thread(new epicsThread(*worker, name, epicsThreadGetStackSize(epicsThreadStackMedium)));
+        thread->start();
+        workers.push_back(worker);
+        this->threads.push_back(thread);
+    }
+}
+
+WorkPool::~WorkPool()
+{
+    shutdown();
+}
+
+size_t WorkPool::getIndex() const
+{
+    return current_pool == this ? current_index : queues.size();
+}
+
+void WorkPool::submit(WorkGroup &group, Task task)
+{
+    {
+        epicsGuard<epicsMutex> guard(group.mutex);
+        ++group.outstanding;
+    }
+    size_t index = getIndex();
+    if (index >= queues.size())
+        index = next_queue++ % queues.size();
+    Item item = { task, &group };
+    {
+        epicsGuard<epicsMutex> guard(queues[index]->mutex);
+        queues[index]->items.push_back(item);
+    }
+    ++pending;
+    work_available.signal();
+}
+
+bool WorkPool::take(size_t index, Item &item)
+{
+    if (pending == 0)
+        return false;
+    const size_t N = queues.size();
+    // Newest item of own deque, most likely still in the cache
+    if (index < N)
+    {
+        Queue &own = *queues[index];
+        epicsGuard<epicsMutex> guard(own.mutex);
+        if (! own.items.empty())
+        {
+            item = own.items.back();
+            own.items.pop_back();
+            --pending;
+            return true;
+        }
+    }
+    // Oldest item of another deque, for split ranges the largest section
+    for (size_t i=1; i<=N; ++i)
+    {
+        Queue &other = *queues[(index + i) % N];
+        epicsGuard<epicsMutex> guard(other.mutex);
+        if (! other.items.empty())
+        {
+            item = other.items.front();
+            other.items.pop_front();
+            --pending;
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkPool::run(Item &item)
+{
+    std::exception_ptr error;
+    try
+    {
+        item.task();
+    }
+    catch (...)
+    {   // Keep the thread, report to the waiting thread
+        error = std::current_exception();
+    }
+    // Release what the task holds before the group is done
+    item.task = Task();
+    WorkGroup &group = *item.group;
+    epicsGuard<epicsMutex> guard(group.mutex);
+    if (error  &&  ! group.error)
+        group.error = error;
+    if (--group.outstanding == 0)
+        group.done.signal();
+}
+
+void WorkPool::work(size_t index)
+{
+    current_pool = this;
+    current_index = index;
+    while (do_run)
+    {
+        Item item;
+        if (! take(index, item))
+        {   // Check do_run at least every 0.5 seconds
+            work_available.wait(0.5);
+            continue;
+        }
+        // Wake another thread for the remaining items
+        if (pending > 0)
+            work_available.signal();
+        run(item);
+    }
+}
+
+void WorkPool::wait(WorkGroup &group)
+{
+    const size_t index = getIndex();
+    while (true)
+    {
+        {   // Returns only after the last task released the group
+            epicsGuard<epicsMutex> guard(group.mutex);
+            if (group.outstanding == 0)
+            {
+                if (group.error)
+                {
+                    std::exception_ptr error = group.error;
+                    group.error = std::exception_ptr();
+                    std::rethrow_exception(error);
+                }
+                return;
+            }
+        }
+        // Pool threads help, which also avoids a deadlock when
+        // all pool threads wait for nested groups
+        Item item;
+        if (index < queues.size()  &&  take(index, item))
+            run(item);
+        else
+            group.done.wait(0.1);
+    }
+}
+
+void WorkPool::split(WorkGroup &group, size_t start, size_t end, size_t grain,
+                     const std::function<void (size_t, size_t)> *body)
+{
+    // Submit upper halves, keep working on the lower half
+    while (end - start > grain)
+    {
+        size_t middle = start + (end - start) / 2;
+        submit(group, [this, &group, middle, end, grain, body]()
+        {
+            split(group, middle, end, grain, body);
+        });
+        end = middle;
+    }
+    (*body)(start, end);
+}
+
+void WorkPool::parallelFor(size_t start, size_t end, size_t grain, std::function<void (size_t, size_t)> body)
+{
+    if (end <= start)
+        return;
+    if (grain < 1)
+        grain = 1;
+    WorkGroup group;
+    // Submitted sections refer to the group, so wait for them
+    // even when the section of this thread throws
+    std::exception_ptr error;
+    try
+    {
+        split(group, start, end, grain, &body);
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+    wait(group);
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void WorkPool::shutdown()
+{
+    if (threads.empty())
+        return;
+    do_run = false;
+    for (size_t i=0; i<workers.size(); ++i)
+    {
+        work_available.signal();
+        if (! workers[i]->thread_exited.wait(5.0))
+            std::cout << "Work pool thread " << i << " does not exit" << std::endl;
+    }
+    threads.clear();
+    workers.clear();
+}
+
+WorkPool &WorkPool::getDefault()
+{
+    static WorkPool pool(epicsThreadGetCPUs(), "work_pool");
+    return pool;
+}
+
 }} // namespace neutronServer, epics
@@ -8,46 +8,335 @@
  */
 #ifndef __WORKER_RUNNABLE_H__
 #define __WORKER_RUNNABLE_H__
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <vector>
 #include <epicsEvent.h>
+#include <epicsMutex.h>
 #include <epicsThread.h>
 
 namespace epics { namespace neutronServer {
 
-/** Runnable that performs work */
+/** Work item submitted to a WorkerRunnable
+ *
+ *  Shared by the worker thread and the submitter,
+ *  which can wait for the item or attach a continuation.
+ */
+class WorkItem
+{
+public:
+    WorkItem(std::function<void ()> work)
+    : work(work), done(false)
+    {}
+
+    /** @return Has the item completed? */
+    bool isDone();
+
+    /** Wait until the item has completed */
+    void wait();
+
+    /** @return Exception thrown by the work, null if none or not yet completed */
+    std::exception_ptr getError();
+
+    /** Call 'continuation' once the item has completed.
+     *  Also called when the work threw, see getError().
+     *  Runs in the worker thread, or right away in the calling thread
+     *  if the item has already completed.
+     */
+    void then(std::function<void ()> continuation);
+
+private:
+    friend class WorkerRunnable;
+
+    /** Perform the work, then complete, also when the work throws.
+     *  Called by worker thread
+     */
+    void execute();
+
+    /** Mark as completed and call continuations */
+    void complete();
+
+    std::function<void ()> work;
+    epicsMutex mutex;
+    bool done;
+    /** Exception thrown by the work, guarded by mutex */
+    std::exception_ptr error;
+    std::vector<std::function<void ()> > continuations;
+    /** Signaled when the item completes */
+    epicsEvent completed;
+};
+
+/** Handle for a work item that provides a result */
+template <typename Result>
+class WorkHandle
+{
+public:
+    WorkHandle()
+    {}
+
+    WorkHandle(std::shared_ptr<WorkItem> item, std::shared_ptr<Result> result)
+    : item(item), result(result)
+    {}
+
+    /** @return Does the handle refer to a work item? */
+    bool isValid() const
+    {
+        return item.get() != 0;
+    }
+
+    /** @return Has the item completed? */
+    bool isDone() const
+    {
+        return item->isDone();
+    }
+
+    /** Wait until the item has completed */
+    void wait() const
+    {
+        item->wait();
+    }
+
+    /** Wait until the item has completed
+     *  @return Result of the item
+     *  Re-throws the exception thrown by the work
+     */
+    Result &get() const
+    {
+        item->wait();
+        std::exception_ptr error = item->getError();
+        if (error)
+            std::rethrow_exception(error);
+        return *result;
+    }
+
+    /** Call 'continuation' with the result once the item has completed,
+     *  see WorkItem::then().
+     *  Not called when the work threw
+     */
+    void then(std::function<void (Result &)> continuation) const
+    {
+        std::shared_ptr<Result> result = this->result;
+        // Item outlives its continuations
+        WorkItem *item = this->item.get();
+        item->then([item, result, continuation]()
+        {
+            if (! item->getError())
+                continuation(*result);
+        });
+    }
+
+private:
+    std::shared_ptr<WorkItem> item;
+    std::shared_ptr<Result> result;
+};
+
+/** Runnable that performs work
+ *
+ *  Work items are queued and executed in order.
+ *  At most 'max_outstanding' items may be queued or executing,
+ *  submitting more blocks until an item completes.
+ */
 class WorkerRunnable : public epicsThreadRunable
 {
 public:
-    WorkerRunnable()
-    : do_run(true)
+    WorkerRunnable(size_t max_outstanding = 1)
+    : do_run(true), max_outstanding(max_outstanding > 0 ? max_outstanding : 1), outstanding(0), stopped(false)
     {}
 
     void run();
 
-    /** Exit the runnable and thus thread */
+    /** Exit the runnable and thus thread.
+     *  Items that have not been executed complete without performing their work
+     */
     void shutdown();
 
+    /** Set maximum number of outstanding items */
+    void setMaxOutstanding(size_t max_outstanding);
+
+    /** Queue work for the worker thread
+     *  @return Item to wait for or continue
+     */
+    std::shared_ptr<WorkItem> submit(std::function<void ()> work);
+
+    /** Queue work that provides a result
+     *  @return Handle to wait for the result or continue
+     */
+    template <typename Result>
+    WorkHandle<Result> submit(std::function<void (Result &)> work)
+    {
+        std::shared_ptr<Result> result(new Result());
+        return WorkHandle<Result>(submit([result, work]()
+                                  {
+                                      work(*result);
+                                  }),
+                                  result);
+    }
+
 protected:
+    /** Queue doWork(), see waitForCompletion() */
     void startWork()
     {
-        new_work.signal();
+        started_work = submit([this]()
+        {
+            doWork();
+        });
     }
-    virtual void doWork() = 0;
+    virtual void doWork()
+    {}
+    /** Wait for the doWork() queued by the last startWork(),
+     *  which also returns when shutdown() dropped it
+     */
     void waitForCompletion()
     {
-        work_completed.wait();
+        if (started_work)
+            started_work->wait();
     }
 
 private:
     /** Should thread run? */
-    bool do_run;
+    std::atomic<bool> do_run;
     /** Did thread exit? */
     epicsEvent thread_exited;
 
     /** Has new work request been submitted? */
     epicsEvent new_work;
 
-    /** Signaled when work has completed */
-    epicsEvent work_completed;
+    /** Item of the last startWork() */
+    std::shared_ptr<WorkItem> started_work;
+
+    /** Queued items, their limit and the number of queued or executing items */
+    epicsMutex mutex;
+    std::deque<std::shared_ptr<WorkItem> > queue;
+    size_t max_outstanding, outstanding;
+    /** Has thread stopped taking items? */
+    bool stopped;
+
+    /** Signaled when an item completes */
+    epicsEvent space_available;
+};
+
+/** Tasks submitted to a WorkPool that can be waited for as a group */
+class WorkGroup
+{
+public:
+    WorkGroup()
+    : outstanding(0)
+    {}
+
+private:
+    friend class WorkPool;
+    epicsMutex mutex;
+    /** Number of submitted tasks that have not completed, guarded by mutex */
+    size_t outstanding;
+    /** First exception thrown by a task, guarded by mutex */
+    std::exception_ptr error;
+    /** Signaled when the last outstanding task completes */
+    epicsEvent done;
+};
+
+/** Pool of threads that execute tasks, shared by all compute stages
+ *
+ *  Each thread has its own deque of tasks.
+ *  A thread takes the newest task from its own deque,
+ *  and when that is empty it steals the oldest task of another thread.
+ *  Tasks submitted by a pool thread go to its own deque,
+ *  tasks from other threads are distributed round-robin.
+ *
+ *  Threads that find no task wait for a signal instead of spinning.
+ *  A pool thread that waits for a group helps by running tasks.
+ *  Other threads only wait, so their latency does not include
+ *  tasks of unrelated groups.
+ */
+class WorkPool
+{
+public:
+    typedef std::function<void ()> Task;
+
+    /** @param threads Number of threads, at least 1
+     *  @param name Name of the threads
+     */
+    WorkPool(size_t threads, const char *name = "work_pool");
+    ~WorkPool();
+
+    /** @return Number of threads in the pool */
+    size_t getThreads() const
+    {
+        return queues.size();
+    }
+
+    /** Submit a task as part of a group */
+    void submit(WorkGroup &group, Task task);
+
+    /** Wait until all tasks of the group have completed.
+     *  Re-throws the first exception thrown by a task of the group
+     */
+    void wait(WorkGroup &group);
+
+    /** Call body(start, end) for sections of the range [start, end) in parallel
+     *
+     *  The range is split in halves until sections have at most 'grain' elements,
+     *  so idle threads can steal the larger remaining halves.
+     *  Returns when all sections have been handled.
+     */
+    void parallelFor(size_t start, size_t end, size_t grain, std::function<void (size_t, size_t)> body);
+
+    /** Stop the threads. Pending tasks are not executed */
+    void shutdown();
+
+    /** @return Pool shared by all compute stages, one thread per CPU */
+    static WorkPool &getDefault();
+
+private:
+    class Worker;
+
+    /** Task and the group to which it belongs */
+    struct Item
+    {
+        Task task;
+        WorkGroup *group;
+    };
+
+    /** Deque of one thread */
+    struct Queue
+    {
+        epicsMutex mutex;
+        std::deque<Item> items;
+    };
+
+    /** Thread loop of worker 'index' */
+    void work(size_t index);
+
+    /** @return Index of the calling pool thread, or getThreads() for other threads */
+    size_t getIndex() const;
+
+    /** Take newest item of own deque, or steal the oldest of another deque
+     *  @param index Index of the calling thread, see getIndex()
+     */
+    bool take(size_t index, Item &item);
+
+    /** Run task of item, then mark it as completed in its group,
+     *  also when it throws
+     */
+    void run(Item &item);
+
+    /** Split [start, end) into tasks of the group */
+    void split(WorkGroup &group, size_t start, size_t end, size_t grain,
+               const std::function<void (size_t, size_t)> *body);
+
+    std::vector<std::shared_ptr<Queue> > queues;
+    std::vector<std::shared_ptr<Worker> > workers;
+    std::vector<std::shared_ptr<epicsThread> > threads;
+    /** Should threads run? */
+    std::atomic<bool> do_run;
+    /** Number of items in all deques */
+    std::atomic<size_t> pending;
+    /** Deque for the next task submitted by a thread outside of the pool */
+    std::atomic<size_t> next_queue;
+    /** Signaled when tasks are submitted */
+    epicsEvent work_available;
 };
 
 }} // namespace neutronServer, epics
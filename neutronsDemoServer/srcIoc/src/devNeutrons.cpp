@@ -2,12 +2,31 @@
  *
  * Device support for EPICS V3 records that interface with a V4 record
  *
- * When the V3 record with DTYP "Demo Neutron Delay" is loaded to control the V4 data,
- * its global_init() will create the V4 record.
+ * Each V3 record selects its V4 record via the OUT link, for example "@neutrons:bank1".
+ * All V3 records with the same link control the same generator and V4 record.
+ * Without a link, the V4 record is called "neutrons".
+ * The first V3 record for a link creates the V4 record and its generator thread,
+ * so one IOC can serve several detector banks, each with its own thread.
+ *
+ * ai and longin records with DTYP "Demo Neutron Stats" and SCAN "I/O Intr" read
+ * generator statistics via their INP link, for example "@neutrons:bank1 rate".
+ * A thread updates the statistics every neutronsStatsPeriod seconds.
+ *
+ * bo, mbbo and longout records with DTYP "Demo Neutron Setting" change generator
+ * settings via their OUT link, for example "@neutrons:bank1 batch".
+ * The generator applies them at the start of the next pulse.
+ *
+ * waveform records with DTYP "Demo Neutron Summary", FTVL "DOUBLE" and SCAN "I/O Intr"
+ * read a time-of-flight histogram or event counts per detector bank via their INP link,
+ * for example "@neutrons:bank1 tof" or "@neutrons:bank1 banks".
+ * Each pulse is added to the summary, which is published every neutronsSummaryPeriod seconds.
  *
  * When no V3 record are loaded to control the V4 record, it needs to be created
  * from the IOC shell via the neutronServerCreateRecord command.
  *
+ * Records are served via pvDatabase or, when built with USE_PVXS,
+ * the PVXS server of the IOC.
+ *
  * @author Kay Kasemir
  */
 #include <stddef.h>
@@ -23,67 +42,505 @@
 #include "recSup.h"
 #include "devSup.h"
 #include "link.h"
+#include "dbCommon.h"
+#include "dbScan.h"
 #include "aoRecord.h"
+#include "aiRecord.h"
+#include "longinRecord.h"
+#include "boRecord.h"
+#include "mbboRecord.h"
+#include "longoutRecord.h"
+#include "waveformRecord.h"
+#include "menuFtype.h"
+#include "epicsAtomic.h"
+#include "epicsExit.h"
+#include "epicsGuard.h"
+#include "epicsMutex.h"
+#include "epicsThread.h"
+#include "epicsTime.h"
 #include "epicsExport.h"
 
-#include <pv/pvDatabase.h>
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
 #include <neutronServer.h>
+#include <pulseSummary.h>
+#include <iocServer.h>
 
 using namespace std;
-using namespace std::tr1;
-using namespace epics::pvDatabase;
 using namespace epics::neutronServer;
 
-static NeutronPVRecord::shared_pointer neutrons_record;
-static shared_ptr<FakeNeutronEventRunnable> fake_event_runnable;
-static shared_ptr<epicsThread> fake_event_thread;
+#define DEV_NEUTRONS_DEFAULT_NAME "neutrons" /** V4 record name when the link is empty */
+
+/** Statistics provided to ai and longin records */
+enum StatisticType
+{
+    STAT_PACKETS,   /** Pulses published since start */
+    STAT_RATE,      /** Pulses per second */
+    STAT_SLOW,      /** Pulses that started late during the last period */
+    STAT_EVENTS,    /** Events in the last pulse */
+    STAT_FILL,      /** Average microseconds for setting array values during the last period */
+    STAT_POST,      /** Average microseconds for posting during the last period */
+    STAT_COUNT
+};
+
+static const char *statistic_names[STAT_COUNT] = { "packets", "rate", "slow", "events", "fill", "post" };
+
+/** Generator, V4 record and its statistics */
+struct Instance
+{
+    shared_ptr<FakeNeutronEventRunnable> runnable;
+    IOSCANPVT scan;
+    epicsMutex mutex;
+    NeutronStatistics previous;
+    epicsTime previous_time;
+    double values[STAT_COUNT];
+    /** Histogram and bank counts for waveform records, created on demand */
+    shared_ptr<PulseSummary> summary;
+    IOSCANPVT summary_scan;
+
+    Instance()
+    : previous_time(epicsTime::getCurrent())
+    {
+        scanIoInit(&scan);
+        scanIoInit(&summary_scan);
+        for (int i=0; i<STAT_COUNT; ++i)
+            values[i] = 0.0;
+    }
+};
+
+/** Instances by V4 record name */
+static map<string, shared_ptr<Instance> > instances;
+
+/** Seconds between statistics updates, set via "var neutronsStatsPeriod 5" before iocInit */
+double neutronsStatsPeriod = 1.0;
+
+/** Seconds between waveform updates, set via "var neutronsSummaryPeriod 2" before iocInit */
+double neutronsSummaryPeriod = 1.0;
+
+/** Time-of-flight histogram bins, set via "var neutronsTOFBins 500" before iocInit */
+int neutronsTOFBins = NS_SUMMARY_TOF_BINS;
+
+/** Get or create the instance for a V4 record name */
+static Instance *getInstance(string name)
+{
+    if (name.empty())
+        name = DEV_NEUTRONS_DEFAULT_NAME;
+    shared_ptr<Instance> &instance = instances[name];
+    if (! instance)
+    {
+        cout << "Creating V4 '" << name << "' record" << endl;
+        instance.reset(new Instance());
+        instance->runnable.reset(new FakeNeutronEventRunnable(name, 1, 10, false, 0, 0));
+        iocAddRecord(name, instance->runnable->getRecord());
+    }
+    return instance.get();
+}
+
+/** Update the statistics of all instances, then trigger their I/O Intr records */
+static void updateStatistics()
+{
+    for (auto entry = instances.begin(); entry != instances.end(); ++entry)
+    {
+        Instance &instance = *entry->second;
+        NeutronStatistics current = instance.runnable->getStatistics();
+        epicsTime now = epicsTime::getCurrent();
+        {
+            epicsGuard<epicsMutex> guard(instance.mutex);
+            const NeutronStatistics &previous = instance.previous;
+            double seconds = now - instance.previous_time;
+            uint64_t fill_runs = current.fill_runs - previous.fill_runs;
+            uint64_t post_runs = current.post_runs - previous.post_runs;
+            instance.values[STAT_PACKETS] = current.packets;
+            instance.values[STAT_RATE] = seconds > 0 ? (current.packets - previous.packets) / seconds : 0.0;
+            instance.values[STAT_SLOW] = current.slow - previous.slow;
+            instance.values[STAT_EVENTS] = current.events;
+            instance.values[STAT_FILL] = fill_runs > 0 ? (current.fill_ns - previous.fill_ns) / 1000.0 / fill_runs : 0.0;
+            instance.values[STAT_POST] = post_runs > 0 ? (current.post_ns - previous.post_ns) / 1000.0 / post_runs : 0.0;
+            instance.previous = current;
+            instance.previous_time = now;
+        }
+        scanIoRequest(instance.scan);
+    }
+}
+
+/** Cleared by the exit handler, read by the statistics thread */
+static int statistics_running = 1;
 
-/** Initialize the PVA record:
- *  On pass 0, create it,
- *  on pass 1, start it.
+static void stopStatistics(void *)
+{
+    epics::atomic::set(statistics_running, 0);
+}
+
+static void statisticsThread(void *)
+{
+    while (epics::atomic::get(statistics_running))
+    {
+        epicsThreadSleep(neutronsStatsPeriod > 0 ? neutronsStatsPeriod : 1.0);
+        if (epics::atomic::get(statistics_running))
+            updateStatistics();
+    }
+}
+
+/** Start the generators
+ *
+ *  On pass 0, before init_record, nothing to do,
+ *  on pass 1, after all init_record calls, start the generator threads
+ *  and the thread that updates the statistics.
+ *  Each dset calls this, but the threads are started once.
  */
 static long global_init(int pass)
 {
-    if (pass == 0)
+    static bool started = false;
+    if (pass == 1  &&  !started)
     {
-        string name("neutrons");
-        cout << "Creating V4 '" << name << "' record" << endl;
-        FakeNeutronEventRunnable *runnable = new FakeNeutronEventRunnable(name, 1, 10, false, 0, 0);
-        auto record = runnable->getRecord();
-        if (! epics::pvDatabase::PVDatabase::getMaster()->addRecord(record))
-            std::cout << "Cannot create neutron record '" << name << "'" << std::endl;
-        fake_event_runnable.reset(runnable);
+        started = true;
+        for (auto instance = instances.begin(); instance != instances.end(); ++instance)
+        {
+            cout << "Starting demo neutron event thread for '" << instance->first << "'" << endl;
+            string thread_name = "FakeNeutrons:" + instance->first;
+            iocStartRunnable(instance->second->runnable, thread_name.c_str());
+        }
+        if (! instances.empty())
+        {
+            epicsAtExit(stopStatistics, 0);
+            epicsThreadCreate("neutronsStats", epicsThreadPriorityLow,
+                              epicsThreadGetStackSize(epicsThreadStackSmall),
+                              statisticsThread, 0);
+        }
     }
-    else if (pass == 1)
+    return 0;
+}
+
+/** Show statistics of all instances for 'dbior'.
+ *  Only one dset reports, since they all share the instances
+ */
+static long report(int level)
+{
+    for (auto instance = instances.begin(); instance != instances.end(); ++instance)
     {
-        cout << "Starting demo neutron event thread" << endl;
-        fake_event_thread.reset(new epicsThread(*fake_event_runnable.get(), "FakeNeutrons", epicsThreadGetStackSize(epicsThreadStackMedium)));
-        fake_event_thread->start();
+        cout << "Demo neutron events '" << instance->first << "':" << endl;
+        instance->second->runnable->report(level);
     }
     return 0;
 }
 
+/** Trim spaces, as in "@ neutrons:bank1 " */
+static string trim(const string &text)
+{
+    size_t first = text.find_first_not_of(' ');
+    if (first == string::npos)
+        return string();
+    return text.substr(first, text.find_last_not_of(' ') - first + 1);
+}
+
+/** Get or create the instance for the OUT link of an ao record, "@name" */
 static long init_record(struct aoRecord	*rec)
 {
+    if (rec->out.type != INST_IO)
+    {
+        recGblRecordError(S_db_badField, (void *)rec, "devNeutrons: OUT must be INST_IO, \"@name\"");
+        return S_db_badField;
+    }
+    rec->dpvt = getInstance(trim(rec->out.value.instio.string));
     return 2; /* Don't convert */
 }
 
 static long write_delay(struct aoRecord *rec)
 {
-    fake_event_runnable->setDelay(rec->oval);
+    Instance *instance = static_cast<Instance *>(rec->dpvt);
+    if (instance)
+        instance->runnable->setDelay(rec->oval);
     return 0;
 }
 
 static long write_count(struct aoRecord *rec)
 {
-    fake_event_runnable->setCount((size_t) rec->rval);
+    Instance *instance = static_cast<Instance *>(rec->dpvt);
+    if (instance)
+        instance->runnable->setCount((size_t) rec->rval);
     return 0;
 }
 
 
 static long write_id(struct aoRecord *rec)
 {
-    fake_event_runnable->setID(rec->rval);
+    Instance *instance = static_cast<Instance *>(rec->dpvt);
+    if (instance)
+        instance->runnable->setID(rec->rval);
+    return 0;
+}
+
+/** Statistic read by an ai or longin record */
+struct StatisticLink
+{
+    Instance *instance;
+    StatisticType type;
+};
+
+/** Parse link "@name item" into the instance and the index of the item
+ *  @param names Known items
+ *  @return Index of item, -1 on error
+ */
+static int parseItemLink(dbCommon *rec, const DBLINK &link, const char *names[], int count, Instance *&instance)
+{
+    if (link.type != INST_IO)
+    {
+        recGblRecordError(S_db_badField, (void *)rec, "devNeutrons: Link must be INST_IO, \"@name item\"");
+        return -1;
+    }
+    string text = trim(link.value.instio.string);
+    size_t sep = text.find_last_of(' ');
+    string name = sep == string::npos ? string() : trim(text.substr(0, sep));
+    string item = sep == string::npos ? text : text.substr(sep + 1);
+    for (int i=0; i<count; ++i)
+        if (item == names[i])
+        {
+            instance = getInstance(name);
+            return i;
+        }
+    string message = "devNeutrons: Unknown item '" + item + "', use";
+    for (int i=0; i<count; ++i)
+        message += string(" ") + names[i];
+    recGblRecordError(S_db_badField, (void *)rec, message.c_str());
+    return -1;
+}
+
+/** Parse INP link "@name statistic" into record's dpvt */
+static long init_statistic(dbCommon *rec, const DBLINK &inp)
+{
+    Instance *instance;
+    int index = parseItemLink(rec, inp, statistic_names, STAT_COUNT, instance);
+    if (index < 0)
+        return S_db_badField;
+    StatisticLink *stat = new StatisticLink();
+    stat->instance = instance;
+    stat->type = static_cast<StatisticType>(index);
+    rec->dpvt = stat;
+    return 0;
+}
+
+/** @return Current value of record's statistic */
+static double getStatistic(dbCommon *rec)
+{
+    StatisticLink *stat = static_cast<StatisticLink *>(rec->dpvt);
+    epicsGuard<epicsMutex> guard(stat->instance->mutex);
+    return stat->instance->values[stat->type];
+}
+
+static long get_ioint_info(int cmd, dbCommon *rec, IOSCANPVT *scan)
+{
+    StatisticLink *stat = static_cast<StatisticLink *>(rec->dpvt);
+    if (! stat)
+        return S_db_badField;
+    *scan = stat->instance->scan;
+    return 0;
+}
+
+static long init_ai(struct aiRecord *rec)
+{
+    return init_statistic(reinterpret_cast<dbCommon *>(rec), rec->inp);
+}
+
+static long read_ai(struct aiRecord *rec)
+{
+    if (! rec->dpvt)
+        return S_db_badField;
+    rec->val = getStatistic(reinterpret_cast<dbCommon *>(rec));
+    rec->udf = 0;
+    return 2; /* Don't convert */
+}
+
+static long init_longin(struct longinRecord *rec)
+{
+    return init_statistic(reinterpret_cast<dbCommon *>(rec), rec->inp);
+}
+
+static long read_longin(struct longinRecord *rec)
+{
+    if (! rec->dpvt)
+        return S_db_badField;
+    double value = getStatistic(reinterpret_cast<dbCommon *>(rec));
+    // Statistics are 64 bit, longin only holds 32
+    if (value > 2147483647.0)
+    {
+        rec->val = 2147483647;
+        recGblSetSevr(rec, HW_LIMIT_ALARM, INVALID_ALARM);
+    }
+    else
+        rec->val = static_cast<epicsInt32>(value);
+    return 0;
+}
+
+/** Settings written by bo, mbbo and longout records */
+enum SettingType
+{
+    SET_MODE,       /** 0: Flat, 1: Realistic, 2: Peaks */
+    SET_RANDOM,     /** Random event count? */
+    SET_SKIP,       /** Skip every Nth pulse, 0 for none */
+    SET_THREADS,    /** Array fill threads, 1 or 2 */
+    SET_BATCH,      /** Pulses per update */
+    SET_CPU,        /** First CPU for pinning, -1 for none */
+    SET_COUNT
+};
+
+static const char *setting_names[SET_COUNT] = { "mode", "random", "skip", "threads", "batch", "cpu" };
+
+/** Setting written by a bo, mbbo or longout record */
+struct SettingLink
+{
+    Instance *instance;
+    SettingType type;
+};
+
+/** Parse OUT link "@name setting" into record's dpvt */
+static long init_setting(dbCommon *rec, const DBLINK &out)
+{
+    Instance *instance;
+    int index = parseItemLink(rec, out, setting_names, SET_COUNT, instance);
+    if (index < 0)
+        return S_db_badField;
+    SettingLink *setting = new SettingLink();
+    setting->instance = instance;
+    setting->type = static_cast<SettingType>(index);
+    rec->dpvt = setting;
+    return 2; /* Don't convert */
+}
+
+/** Pass value to the generator, which applies it at the next pulse */
+static long write_setting(dbCommon *rec, long value)
+{
+    SettingLink *setting = static_cast<SettingLink *>(rec->dpvt);
+    if (! setting)
+        return S_db_badField;
+    FakeNeutronEventRunnable &runnable = *setting->instance->runnable;
+    switch (setting->type)
+    {
+    case SET_MODE:
+        runnable.setRealistic(value == 1);
+        runnable.setPeaks(value == 2);
+        break;
+    case SET_RANDOM:
+        runnable.setRandomCount(value != 0);
+        break;
+    case SET_SKIP:
+        runnable.setSkipPackets(value > 0 ? value : 0);
+        break;
+    case SET_THREADS:
+        runnable.setThreads(value > 0 ? value : 1);
+        break;
+    case SET_BATCH:
+        runnable.setBatch(value > 0 ? value : 1);
+        break;
+    case SET_CPU:
+        runnable.setCPU(value);
+        break;
+    default:
+        return S_db_badField;
+    }
+    return 0;
+}
+
+static long init_bo(struct boRecord *rec)
+{
+    return init_setting(reinterpret_cast<dbCommon *>(rec), rec->out);
+}
+
+static long write_bo(struct boRecord *rec)
+{
+    return write_setting(reinterpret_cast<dbCommon *>(rec), rec->val);
+}
+
+static long init_mbbo(struct mbboRecord *rec)
+{
+    return init_setting(reinterpret_cast<dbCommon *>(rec), rec->out);
+}
+
+static long write_mbbo(struct mbboRecord *rec)
+{
+    return write_setting(reinterpret_cast<dbCommon *>(rec), rec->val);
+}
+
+static long init_longout(struct longoutRecord *rec)
+{
+    long status = init_setting(reinterpret_cast<dbCommon *>(rec), rec->out);
+    return status == 2 ? 0 : status;
+}
+
+static long write_longout(struct longoutRecord *rec)
+{
+    return write_setting(reinterpret_cast<dbCommon *>(rec), rec->val);
+}
+
+/** Summaries provided to waveform records */
+enum SummaryType
+{
+    SUMMARY_TOF,    /** Events per time-of-flight bin during the last period */
+    SUMMARY_BANKS,  /** Events per detector bank during the last period */
+    SUMMARY_COUNT
+};
+
+static const char *summary_names[SUMMARY_COUNT] = { "tof", "banks" };
+
+/** Summary read by a waveform record */
+struct SummaryLink
+{
+    Instance *instance;
+    SummaryType type;
+    vector<double> buffer;
+};
+
+/** Parse INP link "@name summary", add summary to the generator on first use */
+static long init_waveform(struct waveformRecord *rec)
+{
+    dbCommon *common = reinterpret_cast<dbCommon *>(rec);
+    if (rec->ftvl != menuFtypeDOUBLE)
+    {
+        recGblRecordError(S_db_badField, (void *)rec, "devNeutrons: FTVL must be DOUBLE");
+        return S_db_badField;
+    }
+    Instance *instance;
+    int index = parseItemLink(common, rec->inp, summary_names, SUMMARY_COUNT, instance);
+    if (index < 0)
+        return S_db_badField;
+    if (! instance->summary)
+    {
+        instance->summary.reset(new PulseSummary(neutronsTOFBins > 0 ? neutronsTOFBins : NS_SUMMARY_TOF_BINS,
+                                                 neutronsSummaryPeriod));
+        IOSCANPVT scan = instance->summary_scan;
+        instance->summary->setListener([scan]() { scanIoRequest(scan); });
+        instance->runnable->addConsumer(instance->summary);
+    }
+    SummaryLink *summary = new SummaryLink();
+    summary->instance = instance;
+    summary->type = static_cast<SummaryType>(index);
+    rec->dpvt = summary;
+    return 0;
+}
+
+static long get_waveform_ioint_info(int cmd, dbCommon *rec, IOSCANPVT *scan)
+{
+    SummaryLink *summary = static_cast<SummaryLink *>(rec->dpvt);
+    if (! summary)
+        return S_db_badField;
+    *scan = summary->instance->summary_scan;
+    return 0;
+}
+
+static long read_waveform(struct waveformRecord *rec)
+{
+    SummaryLink *summary = static_cast<SummaryLink *>(rec->dpvt);
+    if (! summary)
+        return S_db_badField;
+    if (summary->type == SUMMARY_TOF)
+        summary->instance->summary->getTOFHistogram(summary->buffer);
+    else
+        summary->instance->summary->getBankCounts(summary->buffer);
+    size_t count = std::min(summary->buffer.size(), static_cast<size_t>(rec->nelm));
+    std::copy(summary->buffer.begin(), summary->buffer.begin() + count, static_cast<double *>(rec->bptr));
+    rec->nord = count;
     return 0;
 }
 
@@ -101,7 +558,7 @@ struct
 } devAoDemoNeutronDelay =
 {
     6,
-    NULL,
+    (DEVSUPFUN) report,
     (DEVSUPFUN) global_init,
     (DEVSUPFUN) init_record,
     NULL,
@@ -124,7 +581,7 @@ struct
 {
     6,
     NULL,
-    NULL,
+    (DEVSUPFUN) global_init,
     (DEVSUPFUN) init_record,
     NULL,
     (DEVSUPFUN) write_count,
@@ -146,7 +603,7 @@ struct
 {
     6,
     NULL,
-    NULL,
+    (DEVSUPFUN) global_init,
     (DEVSUPFUN) init_record,
     NULL,
     (DEVSUPFUN) write_id,
@@ -156,4 +613,127 @@ epicsExportAddress(dset, devAoDemoNeutronID);
 
 
 
+struct
+{
+    long        number;
+    DEVSUPFUN   report;
+    DEVSUPFUN   init;
+    DEVSUPFUN   init_record;
+    DEVSUPFUN   get_ioint_info;
+    DEVSUPFUN   read;
+    DEVSUPFUN   special_linconv;
+} devAiDemoNeutronStats =
+{
+    6,
+    NULL,
+    (DEVSUPFUN) global_init,
+    (DEVSUPFUN) init_ai,
+    (DEVSUPFUN) get_ioint_info,
+    (DEVSUPFUN) read_ai,
+    NULL
+};
+epicsExportAddress(dset, devAiDemoNeutronStats);
+
+
+struct
+{
+    long        number;
+    DEVSUPFUN   report;
+    DEVSUPFUN   init;
+    DEVSUPFUN   init_record;
+    DEVSUPFUN   get_ioint_info;
+    DEVSUPFUN   read;
+} devLonginDemoNeutronStats =
+{
+    5,
+    NULL,
+    (DEVSUPFUN) global_init,
+    (DEVSUPFUN) init_longin,
+    (DEVSUPFUN) get_ioint_info,
+    (DEVSUPFUN) read_longin
+};
+epicsExportAddress(dset, devLonginDemoNeutronStats);
+
+struct
+{
+    long        number;
+    DEVSUPFUN   report;
+    DEVSUPFUN   init;
+    DEVSUPFUN   init_record;
+    DEVSUPFUN   get_ioint_info;
+    DEVSUPFUN   write;
+} devBoDemoNeutronSetting =
+{
+    5,
+    NULL,
+    (DEVSUPFUN) global_init,
+    (DEVSUPFUN) init_bo,
+    NULL,
+    (DEVSUPFUN) write_bo
+};
+epicsExportAddress(dset, devBoDemoNeutronSetting);
+
+
+struct
+{
+    long        number;
+    DEVSUPFUN   report;
+    DEVSUPFUN   init;
+    DEVSUPFUN   init_record;
+    DEVSUPFUN   get_ioint_info;
+    DEVSUPFUN   write;
+} devMbboDemoNeutronSetting =
+{
+    5,
+    NULL,
+    (DEVSUPFUN) global_init,
+    (DEVSUPFUN) init_mbbo,
+    NULL,
+    (DEVSUPFUN) write_mbbo
+};
+epicsExportAddress(dset, devMbboDemoNeutronSetting);
+
+
+struct
+{
+    long        number;
+    DEVSUPFUN   report;
+    DEVSUPFUN   init;
+    DEVSUPFUN   init_record;
+    DEVSUPFUN   get_ioint_info;
+    DEVSUPFUN   write;
+} devLongoutDemoNeutronSetting =
+{
+    5,
+    NULL,
+    (DEVSUPFUN) global_init,
+    (DEVSUPFUN) init_longout,
+    NULL,
+    (DEVSUPFUN) write_longout
+};
+epicsExportAddress(dset, devLongoutDemoNeutronSetting);
+
+struct
+{
+    long        number;
+    DEVSUPFUN   report;
+    DEVSUPFUN   init;
+    DEVSUPFUN   init_record;
+    DEVSUPFUN   get_ioint_info;
+    DEVSUPFUN   read;
+} devWaveformDemoNeutronSummary =
+{
+    5,
+    NULL,
+    (DEVSUPFUN) global_init,
+    (DEVSUPFUN) init_waveform,
+    (DEVSUPFUN) get_waveform_ioint_info,
+    (DEVSUPFUN) read_waveform
+};
+epicsExportAddress(dset, devWaveformDemoNeutronSummary);
+
+epicsExportAddress(double, neutronsStatsPeriod);
+epicsExportAddress(double, neutronsSummaryPeriod);
+epicsExportAddress(int, neutronsTOFBins);
+
 } // "C"